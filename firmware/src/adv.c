@@ -0,0 +1,366 @@
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/sys/printk.h>
+#include <stdlib.h>
+
+#include "adv.h"
+#include "history.h"
+#include "payload.h"
+
+/*
+ * BLE manufacturer data (company id: 0xFFFF), then the 8-byte sample
+ * (see payload.h). With CONFIG_APP_ADV_TIMING a 7-byte header goes first:
+ *   [0]    uint8     frame type (PAYLOAD_TYPE_TIMED)
+ *   [1–2]  uint16 LE sequence number, +1 per data update
+ *   [3–6]  uint32 LE uptime (ms) of the newest reading in the sample
+ */
+#ifdef CONFIG_APP_ADV_TIMING
+#define ADV_SAMPLE_OFF (2 + PAYLOAD_TIMED_HDR_LEN)
+#else
+#define ADV_SAMPLE_OFF 2
+#endif
+
+static uint8_t mfr_data[ADV_SAMPLE_OFF + PAYLOAD_SAMPLE_LEN] = {
+    0xFF, 0xFF,   /* company id */
+#ifdef CONFIG_APP_ADV_TIMING
+    PAYLOAD_TYPE_TIMED,
+#endif
+};
+
+#ifdef CONFIG_APP_ADV_TIMING
+/*
+ * Flags + complete name + the timed frame exceed the 31-byte legacy
+ * advertising data, so only the shortened name is advertised and the
+ * complete one is sent in the scan response (which also makes the
+ * non-connectable set scannable).
+ */
+static struct bt_data ad[] = {
+    BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_NO_BREDR | BT_LE_AD_GENERAL),
+    BT_DATA(BT_DATA_NAME_SHORTENED, "xG27-S", 6),
+    BT_DATA(BT_DATA_MANUFACTURER_DATA, mfr_data, sizeof(mfr_data)),
+};
+
+static const struct bt_data sd[] = {
+    BT_DATA(BT_DATA_NAME_COMPLETE, "xG27-Sensor", 11),
+};
+#define ADV_SD     sd
+#define ADV_SD_LEN ARRAY_SIZE(sd)
+
+BUILD_ASSERT(3 + (2 + 6) + (2 + sizeof(mfr_data)) <= BT_GAP_ADV_MAX_ADV_DATA_LEN,
+             "timed advertising data exceeds 31 bytes");
+
+/* Sequence number of the data currently handed to the controller */
+static uint16_t adv_seq;
+#else
+static struct bt_data ad[] = {
+    BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_NO_BREDR | BT_LE_AD_GENERAL),
+    BT_DATA(BT_DATA_NAME_COMPLETE, "xG27-Sensor", 11),
+    BT_DATA(BT_DATA_MANUFACTURER_DATA, mfr_data, sizeof(mfr_data)),
+};
+#define ADV_SD     NULL
+#define ADV_SD_LEN 0
+#endif /* CONFIG_APP_ADV_TIMING */
+
+#ifdef CONFIG_APP_ADV_HISTORY
+/*
+ * Extended advertising: ad[2] points here instead of mfr_data and
+ * carries company id + history frame (see history.h).
+ */
+static uint8_t hist_data[2 + CONFIG_APP_ADV_HISTORY_PAYLOAD_MAX] = {0xFF, 0xFF};
+static struct bt_le_ext_adv *hist_set;
+#endif
+
+/* 0.625 ms advertising interval units; max leaves the controller ~12 % slack */
+#define ADV_UNITS(ms) ((ms) * 8 / 5)
+
+static bool ble_ready;
+
+/* Serialises the periodic publish (main thread) and event work (sysworkq) */
+static K_MUTEX_DEFINE(adv_lock);
+
+#ifndef CONFIG_APP_ADV_HISTORY
+/* Last values handed to the controller, for change detection */
+static struct sensor_snapshot advertised;
+static int64_t advertised_ms;
+static bool advertised_valid;
+#endif
+
+#ifndef CONFIG_APP_ADV_HISTORY
+/* Current legacy advertising interval; 0 = stack default (100–150 ms) */
+#ifdef CONFIG_APP_ADV_ADAPTIVE
+static uint32_t interval_ms = CONFIG_APP_ADV_SLOW_INTERVAL_MS;
+#else
+static uint32_t interval_ms;
+#endif
+
+/* Connectable while a GATT client may still connect */
+static bool connectable = IS_ENABLED(CONFIG_APP_BLE_CONNECTABLE);
+
+/* Caller holds adv_lock (or BLE is not ready yet) */
+static int adv_legacy_start(uint32_t ms)
+{
+    struct bt_le_adv_param param = BT_LE_ADV_PARAM_INIT(
+        connectable ? BT_LE_ADV_OPT_CONN : BT_LE_ADV_OPT_NONE,
+        ms ? ADV_UNITS(ms) : BT_GAP_ADV_FAST_INT_MIN_2,
+        ms ? ADV_UNITS(ms + ms / 8) : BT_GAP_ADV_FAST_INT_MAX_2, NULL);
+
+    return bt_le_adv_start(&param, ad, ARRAY_SIZE(ad), ADV_SD, ADV_SD_LEN);
+}
+#endif /* !CONFIG_APP_ADV_HISTORY */
+
+#ifdef CONFIG_APP_ADV_ADAPTIVE
+static struct sensor_snapshot event_snap;
+
+static void adv_event_handler(struct k_work *work);
+static void adv_decay_handler(struct k_work *work);
+static K_WORK_DEFINE(adv_event_work, adv_event_handler);
+static K_WORK_DELAYABLE_DEFINE(adv_decay_work, adv_decay_handler);
+
+/* Caller holds adv_lock */
+static void adv_set_interval(uint32_t ms)
+{
+    if (ms == interval_ms) {
+        return;
+    }
+    bt_le_adv_stop();
+    if (adv_legacy_start(ms) == 0) {
+        interval_ms = ms;
+        return;
+    }
+    printk("BLE adv restart at %u ms failed\n", ms);
+    if (adv_legacy_start(interval_ms) != 0) {
+        ble_ready = false;
+    }
+}
+#endif /* CONFIG_APP_ADV_ADAPTIVE */
+
+#ifdef CONFIG_APP_BLE_CONNECTABLE
+/*
+ * Requested by the connection callbacks (BT RX thread), applied on the
+ * system work queue: the RX thread must never wait for adv_lock while
+ * the holder waits for an HCI command to complete.
+ */
+static atomic_t want_connectable = ATOMIC_INIT(1);
+
+static void adv_restart_handler(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    k_mutex_lock(&adv_lock, K_FOREVER);
+    connectable = atomic_get(&want_connectable) != 0;
+    if (ble_ready) {
+        bt_le_adv_stop();
+        if (adv_legacy_start(interval_ms) != 0) {
+            printk("BLE adv restart failed\n");
+        }
+    }
+    k_mutex_unlock(&adv_lock);
+}
+
+static K_WORK_DEFINE(adv_restart_work, adv_restart_handler);
+
+void adv_set_connectable(bool on)
+{
+    atomic_set(&want_connectable, on);
+    k_work_submit(&adv_restart_work);
+}
+#endif /* CONFIG_APP_BLE_CONNECTABLE */
+
+#ifdef CONFIG_APP_ADV_HISTORY
+/* Caller holds adv_lock (or BLE is not ready yet) */
+static int hist_set_data(void)
+{
+    size_t len = history_encode(&hist_data[2], sizeof(hist_data) - 2);
+
+    if (len == 0) {
+        return -EAGAIN;
+    }
+    ad[2].data_len = (uint8_t)(2 + len);
+    return bt_le_ext_adv_set_data(hist_set, ad, ARRAY_SIZE(ad), NULL, 0);
+}
+
+static int hist_adv_start(void)
+{
+    const uint32_t ms = CONFIG_APP_ADV_HISTORY_INTERVAL_MS;
+    struct bt_le_adv_param param = BT_LE_ADV_PARAM_INIT(
+        BT_LE_ADV_OPT_EXT_ADV, ADV_UNITS(ms), ADV_UNITS(ms + ms / 8), NULL);
+    int err = bt_le_ext_adv_create(&param, NULL, &hist_set);
+
+    if (err) {
+        return err;
+    }
+    /* Company ID only until the first sample is recorded */
+    ad[2].data     = hist_data;
+    ad[2].data_len = 2;
+    err = bt_le_ext_adv_set_data(hist_set, ad, ARRAY_SIZE(ad), NULL, 0);
+    if (err) {
+        return err;
+    }
+    history_start();
+    return bt_le_ext_adv_start(hist_set, BT_LE_EXT_ADV_START_DEFAULT);
+}
+#endif /* CONFIG_APP_ADV_HISTORY */
+
+static void bt_ready_cb(int err)
+{
+    if (err) {
+        printk("BLE error: %d\n", err);
+        return;
+    }
+#if defined(CONFIG_APP_ADV_HISTORY)
+    err = hist_adv_start();
+#else
+    err = adv_legacy_start(interval_ms);
+#endif
+    if (err == 0) {
+        ble_ready = true;
+        printk("BLE advertising: xG27-Sensor\n");
+    }
+}
+
+#ifndef CONFIG_APP_ADV_HISTORY
+static bool outside(int32_t now, int32_t last, int32_t deadband)
+{
+    return abs(now - last) > deadband;
+}
+
+static bool needs_update(const struct sensor_snapshot *s)
+{
+    if (!advertised_valid || s->flags != advertised.flags ||
+        k_uptime_get() - advertised_ms >= CONFIG_APP_ADV_MAX_REFRESH_MS) {
+        return true;
+    }
+    /* Fields of a sensor that is not reading are not compared */
+    if ((s->flags & SENSOR_FLAG_TEMP_HUM) &&
+        (outside(s->temp_cdeg, advertised.temp_cdeg,
+                 CONFIG_APP_ADV_DEADBAND_TEMP_CDEG) ||
+         outside(s->hum_pct, advertised.hum_pct,
+                 CONFIG_APP_ADV_DEADBAND_HUM_PCT))) {
+        return true;
+    }
+    if ((s->flags & SENSOR_FLAG_LUX) &&
+        outside(s->lux, advertised.lux, CONFIG_APP_ADV_DEADBAND_LUX)) {
+        return true;
+    }
+    if ((s->flags & SENSOR_FLAG_MAG) &&
+        outside(s->mag_ut, advertised.mag_ut, CONFIG_APP_ADV_DEADBAND_MAG_UT)) {
+        return true;
+    }
+    return false;
+}
+
+/* Caller holds adv_lock */
+static bool adv_write(const struct sensor_snapshot *s)
+{
+#ifdef CONFIG_APP_ADV_TIMING
+    /* Only a successful update consumes a sequence number, so every gap
+     * the host sees is a lost advertisement */
+    sys_put_le16((uint16_t)(adv_seq + 1), &mfr_data[2 + 1]);
+    sys_put_le32(s->sampled_ms, &mfr_data[2 + 3]);
+#endif
+    payload_put_sample(&mfr_data[ADV_SAMPLE_OFF], s);
+    if (bt_le_adv_update_data(ad, ARRAY_SIZE(ad), ADV_SD, ADV_SD_LEN) != 0) {
+        return false;   /* retried on the next publish */
+    }
+#ifdef CONFIG_APP_ADV_TIMING
+    adv_seq++;
+#endif
+    advertised       = *s;
+    advertised_ms    = k_uptime_get();
+    advertised_valid = true;
+    return true;
+}
+#endif /* !CONFIG_APP_ADV_HISTORY */
+
+void adv_start(void)
+{
+    bt_enable(bt_ready_cb);
+}
+
+bool adv_update(const struct sensor_snapshot *s)
+{
+    bool updated = false;
+
+    k_mutex_lock(&adv_lock, K_FOREVER);
+#ifdef CONFIG_APP_ADV_HISTORY
+    /* New samples land every history period; no deadband to apply */
+    ARG_UNUSED(s);
+    updated = ble_ready && hist_set_data() == 0;
+#else
+    if (ble_ready && needs_update(s)) {
+        updated = adv_write(s);
+    }
+#endif
+    k_mutex_unlock(&adv_lock);
+    return updated;
+}
+
+#ifdef CONFIG_APP_ADV_ADAPTIVE
+static bool is_event(const struct sensor_snapshot *s)
+{
+    if (!advertised_valid) {
+        return false;
+    }
+    if ((s->flags & advertised.flags & SENSOR_FLAG_MAG) &&
+        abs(s->mag_ut - advertised.mag_ut) >= CONFIG_APP_ADV_EVENT_MAG_UT) {
+        return true;
+    }
+    if ((s->flags & advertised.flags & SENSOR_FLAG_LUX) &&
+        abs(s->lux - advertised.lux) >= CONFIG_APP_ADV_EVENT_LUX) {
+        return true;
+    }
+    return false;
+}
+
+static void adv_event_handler(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    k_mutex_lock(&adv_lock, K_FOREVER);
+    if (ble_ready) {
+        adv_write(&event_snap);
+        adv_set_interval(CONFIG_APP_ADV_FAST_INTERVAL_MS);
+    }
+    k_mutex_unlock(&adv_lock);
+    /* Every new event restarts the fast hold period */
+    k_work_reschedule(&adv_decay_work, K_MSEC(CONFIG_APP_ADV_FAST_HOLD_MS));
+}
+
+/* Double the interval every decay step until back at the slow interval */
+static void adv_decay_handler(struct k_work *work)
+{
+    uint32_t next;
+
+    ARG_UNUSED(work);
+    k_mutex_lock(&adv_lock, K_FOREVER);
+    next = MIN(interval_ms * 2, CONFIG_APP_ADV_SLOW_INTERVAL_MS);
+    if (ble_ready) {
+        adv_set_interval(next);
+    }
+    k_mutex_unlock(&adv_lock);
+    if (next < CONFIG_APP_ADV_SLOW_INTERVAL_MS) {
+        k_work_reschedule(&adv_decay_work,
+                          K_MSEC(CONFIG_APP_ADV_DECAY_STEP_MS));
+    }
+}
+#endif /* CONFIG_APP_ADV_ADAPTIVE */
+
+void adv_sample_event(const struct sensor_snapshot *s)
+{
+#ifdef CONFIG_APP_ADV_ADAPTIVE
+    bool event;
+
+    k_mutex_lock(&adv_lock, K_FOREVER);
+    event = ble_ready && is_event(s);
+    if (event) {
+        event_snap = *s;
+    }
+    k_mutex_unlock(&adv_lock);
+    if (event) {
+        k_work_submit(&adv_event_work);
+    }
+#else
+    ARG_UNUSED(s);
+#endif
+}
@@ -0,0 +1,31 @@
+#ifndef ADV_H_
+#define ADV_H_
+
+#include "sensors.h"
+
+/* Enable Bluetooth and start advertising (asynchronously). */
+void adv_start(void);
+
+/*
+ * Publish a snapshot in the manufacturer data. The controller is only
+ * touched when a field moved past its deadband or the forced refresh
+ * interval expired. Returns true if the advertising data was updated.
+ */
+bool adv_update(const struct sensor_snapshot *s);
+
+/*
+ * Feed every new sample. With CONFIG_APP_ADV_ADAPTIVE a large enough
+ * step (magnet, light) is published immediately and switches to the
+ * fast advertising interval, which then decays back to the slow one.
+ * No-op otherwise. Safe to call from the sensor sampling threads.
+ */
+void adv_sample_event(const struct sensor_snapshot *s);
+
+/*
+ * CONFIG_APP_BLE_CONNECTABLE: switch legacy advertising between connectable
+ * (no client connected) and non-connectable (connected, keep
+ * broadcasting for the bridge). Safe to call from BT callbacks.
+ */
+void adv_set_connectable(bool on);
+
+#endif /* ADV_H_ */
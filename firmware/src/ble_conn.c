@@ -0,0 +1,57 @@
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/sys/printk.h>
+
+#include "adv.h"
+
+/*
+ * Connection handling shared by the GATT services (stream, flash log).
+ * One client at a time: advertising goes non-connectable while it is
+ * connected and connectable again once its connection object is freed.
+ */
+
+static void mtu_exchanged(struct bt_conn *conn, uint8_t err,
+                          struct bt_gatt_exchange_params *params)
+{
+    ARG_UNUSED(params);
+    if (err == 0) {
+        printk("BLE: ATT MTU %u\n", bt_gatt_get_mtu(conn));
+    }
+}
+
+static struct bt_gatt_exchange_params mtu_params = {
+    .func = mtu_exchanged,
+};
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+    if (err) {
+        return;
+    }
+    /* Largest PDUs and ATT MTU the peer accepts */
+    bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+    bt_gatt_exchange_mtu(conn, &mtu_params);
+
+    /* Keep broadcasting for the bridge, but no second connection */
+    adv_set_connectable(false);
+    printk("BLE: connected\n");
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+    ARG_UNUSED(conn);
+    printk("BLE: disconnected (0x%02x)\n", reason);
+}
+
+static void recycled(void)
+{
+    adv_set_connectable(true);
+}
+
+BT_CONN_CB_DEFINE(ble_conn_cb) = {
+    .connected    = connected,
+    .disconnected = disconnected,
+    .recycled     = recycled,
+};
@@ -0,0 +1,130 @@
+#include <zephyr/kernel.h>
+
+#include "filter.h"
+
+/* Fractional bits kept between the combine step, the EMA and rounding */
+#define FRAC_BITS  8
+
+enum {
+    CH_TEMP,
+    CH_HUM,
+    CH_LUX,
+    CH_MAG,
+    CH_COUNT,
+};
+
+struct channel {
+    uint8_t flag;
+    int32_t min;
+    int32_t max;
+    int32_t weight;     /* Q15 */
+    int32_t state;      /* output units, FRAC_BITS fractional bits */
+    bool seeded;
+};
+
+static struct channel channels[CH_COUNT] = {
+    [CH_TEMP] = { SENSOR_FLAG_TEMP_HUM, INT16_MIN, INT16_MAX,
+                  CONFIG_APP_FILTER_EMA_TEMP },
+    [CH_HUM]  = { SENSOR_FLAG_TEMP_HUM, 0, UINT8_MAX,
+                  CONFIG_APP_FILTER_EMA_HUM },
+    [CH_LUX]  = { SENSOR_FLAG_LUX, 0, UINT16_MAX,
+                  CONFIG_APP_FILTER_EMA_LUX },
+    [CH_MAG]  = { SENSOR_FLAG_MAG, INT16_MIN, INT16_MAX,
+                  CONFIG_APP_FILTER_EMA_MAG },
+};
+
+static int32_t get_chan(const struct sensor_snapshot *s, int ch)
+{
+    switch (ch) {
+    case CH_TEMP:
+        return s->temp_cdeg;
+    case CH_HUM:
+        return s->hum_pct;
+    case CH_LUX:
+        return s->lux;
+    default:
+        return s->mag_ut;
+    }
+}
+
+static void set_chan(struct sensor_snapshot *s, int ch, int32_t v)
+{
+    /* Round to nearest, then clamp to the field's range */
+    v = CLAMP((v + (1 << (FRAC_BITS - 1))) >> FRAC_BITS,
+              channels[ch].min, channels[ch].max);
+
+    switch (ch) {
+    case CH_TEMP:
+        s->temp_cdeg = (int16_t)v;
+        break;
+    case CH_HUM:
+        s->hum_pct = (uint8_t)v;
+        break;
+    case CH_LUX:
+        s->lux = (uint16_t)v;
+        break;
+    default:
+        s->mag_ut = (int16_t)v;
+        break;
+    }
+}
+
+/* n readings -> one value with FRAC_BITS fractional bits; sorts x */
+static int32_t combine(int32_t *x, size_t n)
+{
+#ifdef CONFIG_APP_FILTER_MEDIAN
+    /* Insertion sort: n is at most 16 */
+    for (size_t i = 1; i < n; i++) {
+        int32_t v = x[i];
+        size_t j = i;
+
+        for (; j > 0 && x[j - 1] > v; j--) {
+            x[j] = x[j - 1];
+        }
+        x[j] = v;
+    }
+    if (n & 1) {
+        return x[n / 2] << FRAC_BITS;
+    }
+    return (x[n / 2 - 1] + x[n / 2]) << (FRAC_BITS - 1);
+#else
+    int32_t sum = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        sum += x[i];
+    }
+    sum <<= FRAC_BITS;
+    /* Round half away from zero */
+    return (sum + (sum < 0 ? -(int32_t)(n / 2) : (int32_t)(n / 2))) / (int32_t)n;
+#endif
+}
+
+void filter_apply(uint8_t flag, const struct sensor_snapshot *in, size_t n,
+                  struct sensor_snapshot *out)
+{
+    int32_t x[CONFIG_APP_FILTER_OVERSAMPLE];
+
+    n = MIN(n, ARRAY_SIZE(x));
+
+    for (int ch = 0; ch < CH_COUNT; ch++) {
+        struct channel *c = &channels[ch];
+        int32_t v;
+
+        if (!(c->flag & flag)) {
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            x[i] = get_chan(&in[i], ch);
+        }
+        v = combine(x, n);
+
+        if (!c->seeded) {
+            c->state = v;
+            c->seeded = true;
+        } else {
+            /* state += w * (v - state); 64-bit product, one SMULL */
+            c->state += (int32_t)(((int64_t)c->weight * (v - c->state)) >> 15);
+        }
+        set_chan(out, ch, c->state);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sensors.h"
+
+/*
+ * Per-channel DSP stage (CONFIG_APP_FILTER), integer only.
+ *
+ * The n oversampled readings of one sensor are combined into one value
+ * with 8 fractional bits (mean, or median with CONFIG_APP_FILTER_MEDIAN).
+ * That value feeds the channel's EMA, whose weight is Q15
+ * (CONFIG_APP_FILTER_EMA_*; 32768 = pass through).
+ */
+
+/*
+ * Filter the channels of the sensor identified by flag from in[0..n-1]
+ * and write the result into those fields of *out (may alias in[0]).
+ * Each channel must only be filtered from one thread at a time.
+ */
+void filter_apply(uint8_t flag, const struct sensor_snapshot *in, size_t n,
+                  struct sensor_snapshot *out);
+
+#endif /* FILTER_H_ */
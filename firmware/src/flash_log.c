@@ -0,0 +1,309 @@
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/fs/fcb.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+
+#include "flash_log.h"
+#include "payload.h"
+#include "sensors.h"
+
+/*
+ * FCB entry (one per batch):
+ *   [0–1]  uint16 LE boot counter (increments on every boot)
+ *   [2]    uint8     record count N
+ *   [3..]  N records of 12 bytes:
+ *     [0–3]   uint32 LE uptime (s) when the record was taken
+ *     [4–11]  snapshot, same 8-byte layout as the advertising payload
+ * Entries are padded to the flash write block size.
+ *
+ * xG27 log service:
+ *   control (write, 1 byte): 0x01 = dump the log, 0x02 = erase it
+ *   data (notify): [0–1] uint16 LE chunk number, then the next piece of
+ *     the log as a byte stream of entries (without padding), oldest
+ *     first. A chunk with no data ends the dump.
+ * The pending RAM batch is written to flash before a dump, so the dump
+ * includes everything recorded up to that point.
+ */
+#define LOG_SVC_UUID \
+    BT_UUID_128_ENCODE(0xc0de2710, 0x0b27, 0x4a5e, 0x8e50, 0x5e4e50520000)
+#define LOG_CTRL_UUID \
+    BT_UUID_128_ENCODE(0xc0de2711, 0x0b27, 0x4a5e, 0x8e50, 0x5e4e50520000)
+#define LOG_DATA_UUID \
+    BT_UUID_128_ENCODE(0xc0de2712, 0x0b27, 0x4a5e, 0x8e50, 0x5e4e50520000)
+
+#define LOG_CMD_DUMP   0x01
+#define LOG_CMD_ERASE  0x02
+
+#define LOG_AREA_ID    FIXED_PARTITION_ID(storage_partition)
+#define LOG_MAGIC      0x78473237   /* "xG27" */
+#define LOG_VERSION    1
+#define LOG_MAX_SECTORS 32
+#define LOG_HDR_LEN    3
+#define LOG_REC_LEN    12
+/* Write block of the flash holding the partition; log_flush() pads to it */
+#define LOG_WRITE_BLOCK \
+    DT_PROP(DT_MTD_FROM_FIXED_PARTITION(DT_NODELABEL(storage_partition)), write_block_size)
+/* Room for the batch plus that padding */
+#define LOG_ENTRY_MAX  ROUND_UP(LOG_HDR_LEN + CONFIG_APP_FLASH_LOG_BATCH * LOG_REC_LEN, \
+                                LOG_WRITE_BLOCK)
+
+#define CHUNK_HDR_LEN  2
+/* ATT notification header is 3 bytes */
+#define CHUNK_MAX_LEN  (CONFIG_BT_L2CAP_TX_MTU - 3)
+
+static const struct bt_uuid_128 log_svc_uuid = BT_UUID_INIT_128(LOG_SVC_UUID);
+static const struct bt_uuid_128 log_ctrl_uuid = BT_UUID_INIT_128(LOG_CTRL_UUID);
+static const struct bt_uuid_128 log_data_uuid = BT_UUID_INIT_128(LOG_DATA_UUID);
+
+static struct fcb log_fcb;
+static struct flash_sector log_sectors[LOG_MAX_SECTORS];
+static uint16_t boot_id;
+static bool log_ready;
+
+/* Only touched from log_wq, which also serialises all FCB access */
+static uint8_t batch[LOG_ENTRY_MAX];
+static uint8_t batch_count;
+
+static struct bt_conn *dump_conn;
+static atomic_t dumping;
+
+static K_THREAD_STACK_DEFINE(log_wq_stack, CONFIG_APP_FLASH_LOG_STACK_SIZE);
+static struct k_work_q log_wq;
+
+static void log_record_handler(struct k_work *work);
+static void log_dump_handler(struct k_work *work);
+static void log_erase_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(log_record_work, log_record_handler);
+static K_WORK_DEFINE(log_dump_work, log_dump_handler);
+static K_WORK_DEFINE(log_erase_work, log_erase_handler);
+
+static ssize_t ctrl_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                          const void *buf, uint16_t len, uint16_t offset,
+                          uint8_t flags)
+{
+    ARG_UNUSED(attr);
+    ARG_UNUSED(flags);
+
+    if (offset != 0 || len != 1) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+    if (!log_ready) {
+        return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+    }
+    switch (*(const uint8_t *)buf) {
+    case LOG_CMD_DUMP:
+        if (atomic_set(&dumping, 1)) {
+            return BT_GATT_ERR(BT_ATT_ERR_PROCEDURE_IN_PROGRESS);
+        }
+        dump_conn = bt_conn_ref(conn);
+        k_work_submit_to_queue(&log_wq, &log_dump_work);
+        break;
+    case LOG_CMD_ERASE:
+        k_work_submit_to_queue(&log_wq, &log_erase_work);
+        break;
+    default:
+        return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+    }
+    return len;
+}
+
+BT_GATT_SERVICE_DEFINE(log_svc,
+    BT_GATT_PRIMARY_SERVICE(&log_svc_uuid),
+    BT_GATT_CHARACTERISTIC(&log_ctrl_uuid.uuid, BT_GATT_CHRC_WRITE,
+                           BT_GATT_PERM_WRITE, NULL, ctrl_write, NULL),
+    BT_GATT_CHARACTERISTIC(&log_data_uuid.uuid, BT_GATT_CHRC_NOTIFY,
+                           BT_GATT_PERM_NONE, NULL, NULL, NULL),
+    BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+);
+
+/* Write the RAM batch as one FCB entry, rotating out the oldest sector when full */
+static int log_flush(void)
+{
+    struct fcb_entry loc;
+    uint16_t len;
+    int err;
+
+    if (batch_count == 0) {
+        return 0;
+    }
+    len = LOG_HDR_LEN + batch_count * LOG_REC_LEN;
+    len = ROUND_UP(len, flash_area_align(log_fcb.fap));
+    sys_put_le16(boot_id, &batch[0]);
+    batch[2] = batch_count;
+    memset(&batch[LOG_HDR_LEN + batch_count * LOG_REC_LEN], 0xff,
+           len - (LOG_HDR_LEN + batch_count * LOG_REC_LEN));
+    batch_count = 0;
+
+    err = fcb_append(&log_fcb, len, &loc);
+    if (err == -ENOSPC) {
+        err = fcb_rotate(&log_fcb);
+        if (err == 0) {
+            err = fcb_append(&log_fcb, len, &loc);
+        }
+    }
+    if (err == 0) {
+        err = flash_area_write(log_fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), batch, len);
+    }
+    if (err == 0) {
+        err = fcb_append_finish(&log_fcb, &loc);
+    }
+    if (err) {
+        printk("Log: write failed (%d), batch dropped\n", err);
+    }
+    return err;
+}
+
+static void log_record_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    uint8_t *rec = &batch[LOG_HDR_LEN + batch_count * LOG_REC_LEN];
+    struct sensor_snapshot s;
+
+    sensors_get_snapshot(&s);
+    sys_put_le32((uint32_t)(k_uptime_get() / 1000), &rec[0]);
+    payload_put_sample(&rec[4], &s);
+    if (++batch_count == CONFIG_APP_FLASH_LOG_BATCH) {
+        log_flush();
+    }
+    k_work_reschedule_for_queue(&log_wq, dwork,
+                                K_MSEC(CONFIG_APP_FLASH_LOG_PERIOD_MS));
+}
+
+static int send_chunk(struct bt_conn *conn, uint8_t *chunk, uint16_t num,
+                      size_t len)
+{
+    sys_put_le16(num, &chunk[0]);
+    /* Blocks for a TX buffer: this work queue is the only sender */
+    return bt_gatt_notify(conn, &log_svc.attrs[3], chunk, CHUNK_HDR_LEN + len);
+}
+
+static void log_dump_handler(struct k_work *work)
+{
+    static uint8_t chunk[CHUNK_MAX_LEN];
+    struct bt_conn *conn = dump_conn;
+    const size_t room = MIN(bt_gatt_get_mtu(conn) - 3, CHUNK_MAX_LEN) - CHUNK_HDR_LEN;
+    struct fcb_entry loc = { 0 };
+    uint32_t entries = 0;
+    uint16_t num = 0;
+    size_t pos = 0;
+    int err = 0;
+
+    ARG_UNUSED(work);
+    log_flush();
+
+    while (err == 0 && fcb_getnext(&log_fcb, &loc) == 0) {
+        uint8_t hdr[LOG_HDR_LEN];
+        size_t off = 0;
+        size_t len;
+
+        err = flash_area_read(log_fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc),
+                              hdr, sizeof(hdr));
+        /* Logical length, without the write block padding */
+        len = MIN(LOG_HDR_LEN + hdr[2] * LOG_REC_LEN, loc.fe_data_len);
+        while (err == 0 && off < len) {
+            size_t n = MIN(room - pos, len - off);
+
+            err = flash_area_read(log_fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc) + off,
+                                  &chunk[CHUNK_HDR_LEN + pos], n);
+            pos += n;
+            off += n;
+            if (err == 0 && pos == room) {
+                err = send_chunk(conn, chunk, num++, pos);
+                pos = 0;
+            }
+        }
+        entries++;
+    }
+    if (err == 0 && pos > 0) {
+        err = send_chunk(conn, chunk, num++, pos);
+    }
+    if (err == 0) {
+        err = send_chunk(conn, chunk, num, 0);
+    }
+    printk("Log: dumped %u entries in %u chunks (%d)\n",
+           (unsigned int)entries, num, err);
+
+    dump_conn = NULL;
+    bt_conn_unref(conn);
+    atomic_set(&dumping, 0);
+}
+
+static void log_erase_handler(struct k_work *work)
+{
+    ARG_UNUSED(work);
+    batch_count = 0;
+    printk("Log: erased (%d)\n", fcb_clear(&log_fcb));
+}
+
+/* Continue the boot counter from the newest entry on flash */
+static void log_read_boot_id(void)
+{
+    struct fcb_entry loc = { 0 };
+    struct fcb_entry last = { 0 };
+    uint8_t buf[2];
+
+    while (fcb_getnext(&log_fcb, &loc) == 0) {
+        last = loc;
+    }
+    if (last.fe_sector != NULL &&
+        flash_area_read(log_fcb.fap, FCB_ENTRY_FA_DATA_OFF(last),
+                        buf, sizeof(buf)) == 0) {
+        boot_id = sys_get_le16(buf) + 1;
+    }
+}
+
+int flash_log_start(void)
+{
+    uint32_t cnt = ARRAY_SIZE(log_sectors);
+    int err;
+
+    err = flash_area_get_sectors(LOG_AREA_ID, &cnt, log_sectors);
+    if (err) {
+        printk("Log: no storage partition (%d)\n", err);
+        return err;
+    }
+    log_fcb.f_magic = LOG_MAGIC;
+    log_fcb.f_version = LOG_VERSION;
+    log_fcb.f_sectors = log_sectors;
+    log_fcb.f_sector_cnt = cnt;
+    log_fcb.f_scratch_cnt = 0;
+
+    err = fcb_init(LOG_AREA_ID, &log_fcb);
+    if (err) {
+        /* Foreign or corrupt contents: start over with an empty log */
+        const struct flash_area *fa;
+
+        printk("Log: formatting storage partition (%d)\n", err);
+        err = flash_area_open(LOG_AREA_ID, &fa);
+        if (err == 0) {
+            err = flash_area_erase(fa, 0, fa->fa_size);
+            flash_area_close(fa);
+        }
+        if (err == 0) {
+            err = fcb_init(LOG_AREA_ID, &log_fcb);
+        }
+        if (err) {
+            printk("Log: init failed (%d)\n", err);
+            return err;
+        }
+    }
+    log_read_boot_id();
+
+    k_work_queue_start(&log_wq, log_wq_stack,
+                       K_THREAD_STACK_SIZEOF(log_wq_stack),
+                       K_PRIO_PREEMPT(8),
+                       &(struct k_work_queue_config){.name = "flash_log"});
+    log_ready = true;
+    k_work_schedule_for_queue(&log_wq, &log_record_work,
+                              K_MSEC(CONFIG_APP_FLASH_LOG_PERIOD_MS));
+
+    printk("Log: boot %u, %u sectors\n", boot_id, (unsigned int)cnt);
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef FLASH_LOG_H_
+#define FLASH_LOG_H_
+
+/*
+ * Circular sample log in the storage partition (CONFIG_APP_FLASH_LOG).
+ *
+ * A snapshot is recorded every CONFIG_APP_FLASH_LOG_PERIOD_MS and kept
+ * in RAM until CONFIG_APP_FLASH_LOG_BATCH records are collected; the
+ * batch is then written as one FCB entry. A connected client downloads
+ * the whole log through the xG27 log GATT service (see flash_log.c).
+ */
+
+/* Mount the log (formatting the partition if needed) and start recording. */
+int flash_log_start(void);
+
+#endif /* FLASH_LOG_H_ */
@@ -0,0 +1,217 @@
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+
+#include "gatt_stream.h"
+#include "payload.h"
+
+/*
+ * xG27 stream service
+ *
+ * Notify characteristic; each notification is one frame sized to the
+ * negotiated ATT MTU:
+ *   [0]    uint8     frame sequence number (wraps; gaps = lost frames)
+ *   [1]    uint8     record count N
+ *   [2..]  N records of 13 bytes:
+ *     [0–3]   uint32 LE uptime (ms) when the sample was taken
+ *     [4]     uint8     sensor that was just sampled (flags bit)
+ *     [5–12]  snapshot, same 8-byte layout as the advertising payload
+ */
+#define STREAM_SVC_UUID \
+    BT_UUID_128_ENCODE(0xc0de2700, 0x0b27, 0x4a5e, 0x8e50, 0x5e4e50520000)
+#define STREAM_DATA_UUID \
+    BT_UUID_128_ENCODE(0xc0de2701, 0x0b27, 0x4a5e, 0x8e50, 0x5e4e50520000)
+
+#define FRAME_HDR_LEN  2
+#define RECORD_LEN     13
+/* ATT notification header is 3 bytes */
+#define FRAME_MAX_LEN  (CONFIG_BT_L2CAP_TX_MTU - 3)
+
+struct stream_record {
+    uint32_t uptime_ms;
+    uint8_t  source;
+    struct sensor_snapshot snap;
+};
+
+static const struct bt_uuid_128 stream_svc_uuid =
+    BT_UUID_INIT_128(STREAM_SVC_UUID);
+static const struct bt_uuid_128 stream_data_uuid =
+    BT_UUID_INIT_128(STREAM_DATA_UUID);
+
+K_MSGQ_DEFINE(stream_q, sizeof(struct stream_record),
+              CONFIG_APP_GATT_STREAM_QUEUE_LEN, 4);
+static K_SEM_DEFINE(stream_sem, 0, 1);
+
+static struct bt_conn *stream_conn;
+static struct k_spinlock conn_lock;
+static atomic_t subscribed;
+/* Records per frame at the current MTU; producer wakes the sender at this */
+static atomic_t frame_records = ATOMIC_INIT((23 - 3 - FRAME_HDR_LEN) / RECORD_LEN);
+static atomic_t dropped;
+static uint8_t frame_seq;
+
+static void ccc_changed(const struct bt_gatt_attr *attr, uint16_t value)
+{
+    ARG_UNUSED(attr);
+
+    atomic_set(&subscribed, value == BT_GATT_CCC_NOTIFY);
+    k_msgq_purge(&stream_q);
+    k_sem_give(&stream_sem);
+}
+
+BT_GATT_SERVICE_DEFINE(stream_svc,
+    BT_GATT_PRIMARY_SERVICE(&stream_svc_uuid),
+    BT_GATT_CHARACTERISTIC(&stream_data_uuid.uuid, BT_GATT_CHRC_NOTIFY,
+                           BT_GATT_PERM_NONE, NULL, NULL, NULL),
+    BT_GATT_CCC(ccc_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+);
+
+static void update_frame_records(struct bt_conn *conn)
+{
+    uint16_t len = MIN(bt_gatt_get_mtu(conn) - 3, FRAME_MAX_LEN);
+
+    atomic_set(&frame_records, (len - FRAME_HDR_LEN) / RECORD_LEN);
+}
+
+static void mtu_updated(struct bt_conn *conn, uint16_t tx, uint16_t rx)
+{
+    ARG_UNUSED(tx);
+    ARG_UNUSED(rx);
+    update_frame_records(conn);
+}
+
+static struct bt_gatt_cb gatt_cb = {
+    .att_mtu_updated = mtu_updated,
+};
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+    k_spinlock_key_t key;
+
+    if (err) {
+        return;
+    }
+    key = k_spin_lock(&conn_lock);
+    stream_conn = bt_conn_ref(conn);
+    k_spin_unlock(&conn_lock, key);
+    /* Back to the default MTU until this link negotiates a larger one */
+    update_frame_records(conn);
+
+    /* Short connection interval; DLE and MTU are handled in ble_conn.c */
+    bt_conn_le_param_update(conn, BT_LE_CONN_PARAM(
+        CONFIG_APP_GATT_STREAM_CONN_INTERVAL, CONFIG_APP_GATT_STREAM_CONN_INTERVAL,
+        0, 400));
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+    k_spinlock_key_t key = k_spin_lock(&conn_lock);
+    struct bt_conn *old = stream_conn;
+
+    ARG_UNUSED(conn);
+    ARG_UNUSED(reason);
+    stream_conn = NULL;
+    k_spin_unlock(&conn_lock, key);
+    if (old != NULL) {
+        bt_conn_unref(old);
+    }
+    atomic_set(&subscribed, 0);
+    printk("Stream: %u records dropped\n",
+           (unsigned int)atomic_set(&dropped, 0));
+}
+
+BT_CONN_CB_DEFINE(stream_conn_cb) = {
+    .connected    = connected,
+    .disconnected = disconnected,
+};
+
+void gatt_stream_push(uint8_t flag, const struct sensor_snapshot *snap)
+{
+    struct stream_record rec = {
+        .uptime_ms = k_uptime_get_32(),
+        .source    = flag,
+        .snap      = *snap,
+    };
+
+    if (!atomic_get(&subscribed)) {
+        return;
+    }
+    if (k_msgq_put(&stream_q, &rec, K_NO_WAIT) != 0) {
+        atomic_inc(&dropped);
+        return;
+    }
+    if (k_msgq_num_used_get(&stream_q) >= (uint32_t)atomic_get(&frame_records)) {
+        k_sem_give(&stream_sem);
+    }
+}
+
+static void put_record(uint8_t *buf, const struct stream_record *rec)
+{
+    sys_put_le32(rec->uptime_ms, &buf[0]);
+    buf[4] = rec->source;
+    payload_put_sample(&buf[5], &rec->snap);
+}
+
+/* Send everything queued, in as few MTU-sized notifications as possible */
+static void stream_flush(struct bt_conn *conn)
+{
+    static uint8_t frame[FRAME_MAX_LEN];
+    const size_t per_frame = atomic_get(&frame_records);
+    struct stream_record rec;
+
+    while (k_msgq_num_used_get(&stream_q) > 0) {
+        size_t n = 0;
+
+        while (n < per_frame && k_msgq_get(&stream_q, &rec, K_NO_WAIT) == 0) {
+            put_record(&frame[FRAME_HDR_LEN + n * RECORD_LEN], &rec);
+            n++;
+        }
+        frame[0] = frame_seq++;
+        frame[1] = (uint8_t)n;
+        /* Blocks for a TX buffer: this thread is the only sender */
+        if (bt_gatt_notify(conn, &stream_svc.attrs[1], frame,
+                           FRAME_HDR_LEN + n * RECORD_LEN) != 0) {
+            atomic_add(&dropped, n);
+            return;
+        }
+    }
+}
+
+static void stream_thread(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    bt_gatt_cb_register(&gatt_cb);
+
+    while (1) {
+        struct bt_conn *conn = NULL;
+        k_spinlock_key_t key;
+
+        if (!atomic_get(&subscribed)) {
+            /* Idle until a client subscribes: no periodic wakeups */
+            k_sem_take(&stream_sem, K_FOREVER);
+            continue;
+        }
+        /* Woken early once a full frame is queued */
+        k_sem_take(&stream_sem, K_MSEC(CONFIG_APP_GATT_STREAM_MAX_LATENCY_MS));
+
+        key = k_spin_lock(&conn_lock);
+        if (stream_conn != NULL) {
+            conn = bt_conn_ref(stream_conn);
+        }
+        k_spin_unlock(&conn_lock, key);
+        if (conn != NULL) {
+            stream_flush(conn);
+            bt_conn_unref(conn);
+        }
+    }
+}
+
+K_THREAD_DEFINE(stream_tid, CONFIG_APP_GATT_STREAM_STACK_SIZE,
+                stream_thread, NULL, NULL, NULL, K_PRIO_PREEMPT(7), 0, 0);
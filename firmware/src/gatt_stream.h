@@ -0,0 +1,13 @@
+#ifndef GATT_STREAM_H_
+#define GATT_STREAM_H_
+
+#include "sensors.h"
+
+/*
+ * Queue one sample for the GATT stream. Dropped (and counted) when no
+ * client is subscribed or the queue is full. Called from the sampling
+ * threads; never blocks.
+ */
+void gatt_stream_push(uint8_t flag, const struct sensor_snapshot *snap);
+
+#endif /* GATT_STREAM_H_ */
@@ -0,0 +1,99 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <string.h>
+
+#include "history.h"
+#include "payload.h"
+#include "sensors.h"
+
+#define HISTORY_HDR_LEN    PAYLOAD_HISTORY_HDR_LEN
+#define HISTORY_MAX_DELTA  (5 * 5)  /* 5 fields, <= 5 varint bytes each */
+
+static struct sensor_snapshot ring[CONFIG_APP_ADV_HISTORY_LEN];
+static size_t head;        /* index of the newest sample */
+static size_t count;
+static uint16_t head_seq;
+static struct k_spinlock lock;
+
+static void history_timer_fn(struct k_timer *timer)
+{
+    struct sensor_snapshot s;
+    k_spinlock_key_t key;
+
+    ARG_UNUSED(timer);
+    sensors_get_snapshot(&s);
+
+    key = k_spin_lock(&lock);
+    head = (head + 1) % ARRAY_SIZE(ring);
+    ring[head] = s;
+    head_seq++;
+    if (count < ARRAY_SIZE(ring)) {
+        count++;
+    }
+    k_spin_unlock(&lock, key);
+}
+
+static K_TIMER_DEFINE(history_timer, history_timer_fn, NULL);
+
+void history_start(void)
+{
+    k_timer_start(&history_timer, K_MSEC(CONFIG_APP_ADV_HISTORY_PERIOD_MS),
+                  K_MSEC(CONFIG_APP_ADV_HISTORY_PERIOD_MS));
+}
+
+static size_t put_varint(uint8_t *buf, int32_t delta)
+{
+    uint32_t v = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    size_t n = 0;
+
+    do {
+        buf[n] = (uint8_t)(v & 0x7F);
+        v >>= 7;
+        if (v) {
+            buf[n] |= 0x80;
+        }
+        n++;
+    } while (v);
+    return n;
+}
+
+size_t history_encode(uint8_t *buf, size_t len)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    const struct sensor_snapshot *newer;
+    size_t pos = HISTORY_HDR_LEN;
+    size_t n;
+
+    if (count == 0 || len < HISTORY_HDR_LEN) {
+        k_spin_unlock(&lock, key);
+        return 0;
+    }
+
+    buf[0] = HISTORY_FRAME_TYPE;
+    buf[1] = CONFIG_APP_ADV_HISTORY_PERIOD_MS / 10;
+    sys_put_le16(head_seq, &buf[2]);
+    newer = &ring[head];
+    payload_put_sample(&buf[5], newer);
+
+    for (n = 1; n < count && n < UINT8_MAX; n++) {
+        const struct sensor_snapshot *s =
+            &ring[(head + ARRAY_SIZE(ring) - n) % ARRAY_SIZE(ring)];
+        uint8_t tmp[HISTORY_MAX_DELTA];
+        size_t used = 0;
+
+        used += put_varint(&tmp[used], s->temp_cdeg - newer->temp_cdeg);
+        used += put_varint(&tmp[used], s->hum_pct - newer->hum_pct);
+        used += put_varint(&tmp[used], s->lux - newer->lux);
+        used += put_varint(&tmp[used], s->mag_ut - newer->mag_ut);
+        used += put_varint(&tmp[used], s->flags - newer->flags);
+        if (pos + used > len) {
+            break;
+        }
+        memcpy(&buf[pos], tmp, used);
+        pos += used;
+        newer = s;
+    }
+    buf[4] = (uint8_t)n;
+    k_spin_unlock(&lock, key);
+    return pos;
+}
@@ -0,0 +1,33 @@
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "payload_layout.h"
+
+/* Manufacturer payload type byte of a history frame */
+#define HISTORY_FRAME_TYPE PAYLOAD_TYPE_HISTORY
+
+/* Start recording the sensor snapshot every CONFIG_APP_ADV_HISTORY_PERIOD_MS. */
+void history_start(void);
+
+/*
+ * Encode the newest samples into buf (manufacturer payload after the
+ * company ID). Stops at the oldest sample or when buf is full.
+ *
+ *   [0]     uint8     frame type (HISTORY_FRAME_TYPE)
+ *   [1]     uint8     sample period (10 ms units)
+ *   [2–3]   uint16 LE sequence number of the newest sample
+ *   [4]     uint8     number of samples N
+ *   [5–12]  newest sample, same 8-byte layout as the legacy payload
+ *   [13..]  N-1 older samples, newest to oldest; each as 5 zigzag
+ *           LEB128 varints: the change of temp, hum, lux, mag, flags
+ *           relative to the next newer sample
+ *
+ * Sample i (0 = newest) has sequence number seq - i. Returns the number
+ * of bytes written, or 0 if nothing has been recorded yet.
+ */
+size_t history_encode(uint8_t *buf, size_t len);
+
+#endif /* HISTORY_H_ */
@@ -0,0 +1,169 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/sys/printk.h>
+
+#include "mag_int.h"
+#include "sensors.h"
+
+BUILD_ASSERT(DT_NODE_HAS_PROP(DT_PATH(zephyr_user), si7210_int_gpios),
+             "CONFIG_APP_MAG_INTERRUPT needs zephyr,user si7210-int-gpios");
+
+/* Si7210 registers used for the output switch */
+#define SI7210_REG_POWER_CTRL  0xc4
+#define SI7210_REG_SW_OP       0xc6   /* [7] low4field, [6:0] threshold */
+#define SI7210_REG_SW_HYST     0xc7   /* [7:6] field polarity, [5:0] hysteresis */
+#define SI7210_REG_CTRL3       0xc9   /* [7:2] tamper, [1] slfast, [0] sltimeena */
+
+#define SI7210_SW_LOW4FIELD    BIT(7)
+#define SI7210_FIELDPOL_ABS    (0 << 6)
+#define SI7210_HYST_NONE       0x3f
+#define SI7210_TAMPER_OFF      (0x3f << 2)
+#define SI7210_SLTIMEENA       BIT(0)
+
+/* Threshold and hysteresis are in 5 µT steps at the 20 mT scale */
+#define SI7210_SW_UNIT_UT      5
+/* Time the chip needs after the wake-up read before it ACKs */
+#define SI7210_WAKE_MS         5
+
+/* The smallest hysteresis the encoding below can express is 8 steps */
+BUILD_ASSERT(CONFIG_APP_MAG_INT_HYSTERESIS_UT == 0 ||
+             CONFIG_APP_MAG_INT_HYSTERESIS_UT >= 8 * SI7210_SW_UNIT_UT,
+             "CONFIG_APP_MAG_INT_HYSTERESIS_UT must be 0 or at least 40");
+
+static const struct i2c_dt_spec si7210_i2c = I2C_DT_SPEC_GET(DT_NODELABEL(si7210));
+static const struct gpio_dt_spec int_gpio =
+    GPIO_DT_SPEC_GET(DT_PATH(zephyr_user), si7210_int_gpios);
+static struct gpio_callback int_cb;
+static bool int_ready;
+/* Second half of mag_int_arm(), on the magnet job's queue */
+static struct k_work_q *arm_queue;
+static struct k_work_delayable arm_work;
+/* SW_OP, SW_HYST and CTRL3 keep their values across the driver's reads
+ * and sleep, so they are written once (again only after a failure) */
+static bool thresholds_set;
+
+/* sw_op[6:0]: threshold = (16 + op[3:0]) << op[6:4]; 0x7f is reserved */
+static uint8_t encode_threshold(uint32_t ut)
+{
+    uint32_t units = ut / SI7210_SW_UNIT_UT;
+
+    for (uint8_t e = 0; e < 8; e++) {
+        if (units < (32U << e)) {
+            uint32_t m = units >> e;
+
+            return (uint8_t)((e << 4) | (m > 16 ? m - 16 : 0));
+        }
+    }
+    return 0x7e;
+}
+
+/* sw_hyst[5:0]: hysteresis = (8 + h[2:0]) << h[5:3]; 0x3f = none */
+static uint8_t encode_hysteresis(uint32_t ut)
+{
+    uint32_t units = ut / SI7210_SW_UNIT_UT;
+
+    if (units == 0) {
+        return SI7210_HYST_NONE;
+    }
+    for (uint8_t e = 0; e < 8; e++) {
+        if (units < (16U << e)) {
+            uint32_t m = units >> e;
+
+            return (uint8_t)((e << 3) | (m > 8 ? m - 8 : 0));
+        }
+    }
+    return 0x3e;
+}
+
+static void int_handler(const struct device *port, struct gpio_callback *cb,
+                        uint32_t pins)
+{
+    ARG_UNUSED(port);
+    ARG_UNUSED(cb);
+    ARG_UNUSED(pins);
+
+    /* Re-armed once the sample is done, so the edges caused by the
+     * driver's own read cannot retrigger it */
+    mag_int_disarm();
+    sensors_trigger(SENSOR_FLAG_MAG);
+}
+
+static void arm_handler(struct k_work *work)
+{
+    const uint8_t thresholds[][2] = {
+        { SI7210_REG_SW_OP, SI7210_SW_LOW4FIELD |
+              encode_threshold(CONFIG_APP_MAG_INT_THRESHOLD_UT) },
+        { SI7210_REG_SW_HYST, SI7210_FIELDPOL_ABS |
+              encode_hysteresis(CONFIG_APP_MAG_INT_HYSTERESIS_UT) },
+        { SI7210_REG_CTRL3, SI7210_TAMPER_OFF | SI7210_SLTIMEENA },
+    };
+    /* sleep = stop = 0 with the sleep timer on: idle sleep, the chip
+     * wakes on its own to measure and update the output pin */
+    const uint8_t idle_sleep[2] = { SI7210_REG_POWER_CTRL, 0x00 };
+    int err = 0;
+
+    ARG_UNUSED(work);
+
+    for (size_t i = 0; i < ARRAY_SIZE(thresholds) && !thresholds_set && err == 0; i++) {
+        err = i2c_write_dt(&si7210_i2c, thresholds[i], sizeof(thresholds[i]));
+    }
+    thresholds_set = err == 0;
+    if (err == 0) {
+        err = i2c_write_dt(&si7210_i2c, idle_sleep, sizeof(idle_sleep));
+    }
+    if (err) {
+        printk("Si7210: threshold mode failed (%d)\n", err);
+        return;
+    }
+    gpio_pin_interrupt_configure_dt(&int_gpio, GPIO_INT_EDGE_BOTH);
+}
+
+void mag_int_arm(void)
+{
+    uint8_t val;
+
+    if (!int_ready) {
+        return;
+    }
+    /* The driver left the chip asleep: the first read only wakes it
+     * (NACK expected, see patches/zephyr-si7210-wakeup-fix.patch). The
+     * registers are written once it is awake, without holding up the
+     * queue in between */
+    (void)i2c_read_dt(&si7210_i2c, &val, 1);
+    k_work_reschedule_for_queue(arm_queue, &arm_work, K_MSEC(SI7210_WAKE_MS));
+}
+
+void mag_int_disarm(void)
+{
+    if (!int_ready) {
+        return;
+    }
+    gpio_pin_interrupt_configure_dt(&int_gpio, GPIO_INT_DISABLE);
+    /* A re-arm still waiting would put the chip to sleep under the driver */
+    k_work_cancel_delayable(&arm_work);
+}
+
+int mag_int_init(struct k_work_q *queue)
+{
+    int err;
+
+    if (!gpio_is_ready_dt(&int_gpio)) {
+        return -ENODEV;
+    }
+    arm_queue = queue;
+    k_work_init_delayable(&arm_work, arm_handler);
+    err = gpio_pin_configure_dt(&int_gpio, GPIO_INPUT);
+    if (err) {
+        return err;
+    }
+    gpio_init_callback(&int_cb, int_handler, BIT(int_gpio.pin));
+    err = gpio_add_callback_dt(&int_gpio, &int_cb);
+    if (err == 0) {
+        int_ready = true;
+        printk("Si7210: threshold %u µT, hysteresis %u µT\n",
+               CONFIG_APP_MAG_INT_THRESHOLD_UT, CONFIG_APP_MAG_INT_HYSTERESIS_UT);
+    }
+    return err;
+}
@@ -0,0 +1,26 @@
+#ifndef MAG_INT_H_
+#define MAG_INT_H_
+
+#include <zephyr/kernel.h>
+
+/*
+ * Si7210 threshold output as a wakeup source (CONFIG_APP_MAG_INTERRUPT).
+ *
+ * Between samples the Si7210 runs in idle sleep on its own sleep timer
+ * and drives its output pin when |B| crosses the threshold. The pin edge
+ * triggers an immediate magnet sample, so short magnet passes are seen
+ * while the polling period stays long.
+ */
+
+/* Configure the interrupt pin. Call once before the first sample;
+ * queue is the magnet job's, so re-arming never overlaps a driver read. */
+int mag_int_init(struct k_work_q *queue);
+
+/* Hand the chip back to threshold mode after the driver read it. Only
+ * the wake-up read happens here; the register writes follow on queue. */
+void mag_int_arm(void);
+
+/* Stop reacting to the pin while the driver talks to the chip. */
+void mag_int_disarm(void);
+
+#endif /* MAG_INT_H_ */
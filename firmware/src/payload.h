@@ -0,0 +1,36 @@
+#ifndef PAYLOAD_H_
+#define PAYLOAD_H_
+
+#include <stdint.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "payload_layout.h"
+#include "sensors.h"
+
+/*
+ * 8-byte sample layout shared by the advertising payload, history
+ * frames, GATT stream records, the flash log and UART telemetry.
+ * Offsets and type bytes come from payload_layout.h, generated at build
+ * time from host/payload.py so both ends decode the same layout:
+ *   [0–1]  int16 LE  temperature (centi-°C)
+ *   [2]    uint8     humidity (%RH)
+ *   [3–4]  uint16 LE ambient light (lux)
+ *   [5–6]  int16 LE  magnetic field (µT)
+ *   [7]    uint8     sensor flags (bit0=temp/hum, bit1=lux, bit2=mag)
+ */
+BUILD_ASSERT(SENSOR_FLAG_TEMP_HUM == PAYLOAD_FLAG_TEMP &&
+             SENSOR_FLAG_LUX == PAYLOAD_FLAG_LUX &&
+             SENSOR_FLAG_MAG == PAYLOAD_FLAG_MAG,
+             "sensor flags out of sync with host/payload.py");
+
+static inline void payload_put_sample(uint8_t *buf,
+                                      const struct sensor_snapshot *s)
+{
+    sys_put_le16((uint16_t)s->temp_cdeg, &buf[PAYLOAD_OFF_TEMP]);
+    buf[PAYLOAD_OFF_HUM] = s->hum_pct;
+    sys_put_le16(s->lux, &buf[PAYLOAD_OFF_LUX]);
+    sys_put_le16((uint16_t)s->mag_ut, &buf[PAYLOAD_OFF_MAG]);
+    buf[PAYLOAD_OFF_FLAGS] = s->flags;
+}
+
+#endif /* PAYLOAD_H_ */
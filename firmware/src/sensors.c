@@ -0,0 +1,522 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/pm/device.h>
+#include <zephyr/pm/device_runtime.h>
+#include <zephyr/sys/printk.h>
+#ifdef CONFIG_APP_SENSOR_RAIL_GATING
+#include <zephyr/drivers/regulator.h>
+#endif
+#ifdef CONFIG_APP_SENSOR_ASYNC
+#include <zephyr/rtio/rtio.h>
+#endif
+
+#include "filter.h"
+#include "mag_int.h"
+#include "sensors.h"
+
+#ifdef CONFIG_APP_FILTER
+#define OVERSAMPLE CONFIG_APP_FILTER_OVERSAMPLE
+#else
+#define OVERSAMPLE 1
+#endif
+
+#ifdef CONFIG_APP_SENSOR_RAIL_GATING
+static const struct device *const sensor_rail = DEVICE_DT_GET(DT_NODELABEL(sw_imu_enable));
+#endif
+
+static struct sensor_snapshot snapshot;
+static struct k_spinlock snapshot_lock;
+static sensors_sample_cb_t sample_cb;
+
+/*
+ * One channel of a sensor: the reading in (physical unit × scale), e.g.
+ * scale 100 for centi-units, is handed to the encoder, which stores it in
+ * the snapshot field the payload carries.
+ */
+struct sensor_chan_map {
+    enum sensor_channel chan;
+    int32_t scale;
+    void (*put)(struct sensor_snapshot *val, int32_t v);
+};
+
+struct sensor_job {
+    const char *name;
+    const struct device *dev;
+    const struct device *bus;
+    struct k_work_q *queue;
+    uint32_t period_ms;
+    uint8_t flag;
+    const struct sensor_chan_map *chans;
+    uint8_t chan_count;
+#ifdef CONFIG_APP_SENSOR_ASYNC
+    /* Queue a read; completion is decoded on the RTIO consumer thread */
+    struct rtio_iodev *iodev;
+    atomic_t busy;
+    /* Readings of the sample in progress (oversampling) */
+    struct sensor_snapshot os[OVERSAMPLE];
+    uint8_t os_count;
+#endif
+    struct k_work_delayable work;
+    int64_t next_ms;
+    bool ready;
+};
+
+/* Encoders: saturate into the snapshot field instead of wrapping. Unused
+ * ones belong to sensors the board does not have. */
+static __maybe_unused void put_temp(struct sensor_snapshot *val, int32_t v)
+{
+    val->temp_cdeg = (int16_t)CLAMP(v, INT16_MIN, INT16_MAX);
+}
+
+static __maybe_unused void put_hum(struct sensor_snapshot *val, int32_t v)
+{
+    val->hum_pct = (uint8_t)CLAMP(v, 0, UINT8_MAX);
+}
+
+static __maybe_unused void put_lux(struct sensor_snapshot *val, int32_t v)
+{
+    val->lux = (uint16_t)CLAMP(v, 0, UINT16_MAX);
+}
+
+static __maybe_unused void put_mag(struct sensor_snapshot *val, int32_t v)
+{
+    val->mag_ut = (int16_t)CLAMP(v, INT16_MIN, INT16_MAX);
+}
+
+#ifdef CONFIG_APP_SENSOR_ASYNC
+/*
+ * Async path: the work items only submit reads, so all drivers'
+ * conversions are in flight together instead of spinning one after
+ * another. One mempool block per outstanding read; each job has at most
+ * one read outstanding.
+ */
+RTIO_DEFINE_WITH_MEMPOOL(sensor_rtio, 4, 4, 4, 64, 4);
+
+/* Read iodev of a node label, for the same channels as its map */
+#define SENSOR_IODEV(_label, ...) \
+    SENSOR_DT_READ_IODEV(_label##_iodev, DT_NODELABEL(_label), __VA_ARGS__)
+#define JOB_IO(_label) .iodev = &_label##_iodev,
+#else
+#define SENSOR_IODEV(_label, ...)
+#define JOB_IO(_label)
+#endif /* CONFIG_APP_SENSOR_ASYNC */
+
+#define SENSOR_JOB(_label, _name, _queue, _period, _flag)          \
+    {                                                               \
+        .name       = _name,                                        \
+        .dev        = DEVICE_DT_GET(DT_NODELABEL(_label)),          \
+        .bus        = DEVICE_DT_GET(DT_BUS(DT_NODELABEL(_label))),  \
+        .queue      = &_queue,                                      \
+        .period_ms  = _period,                                      \
+        .flag       = _flag,                                        \
+        .chans      = _label##_chans,                               \
+        .chan_count = ARRAY_SIZE(_label##_chans),                   \
+        JOB_IO(_label)                                              \
+    },
+
+/*
+ * Sensor fit, from the devicetree: a sensor whose node label is missing
+ * or disabled on the board drops out of jobs[] at build time, and its
+ * flag bit simply stays clear.
+ */
+#if DT_NODE_HAS_STATUS(DT_NODELABEL(si7021), okay)
+static const struct sensor_chan_map si7021_chans[] = {
+    {SENSOR_CHAN_AMBIENT_TEMP, 100, put_temp},
+    {SENSOR_CHAN_HUMIDITY,     1,   put_hum},
+};
+SENSOR_IODEV(si7021, {SENSOR_CHAN_AMBIENT_TEMP, 0}, {SENSOR_CHAN_HUMIDITY, 0});
+#define JOB_SI7021 SENSOR_JOB(si7021, "Si7021", slow_wq, \
+                              CONFIG_APP_TEMP_PERIOD_MS, SENSOR_FLAG_TEMP_HUM)
+#else
+#define JOB_SI7021
+#endif
+
+#if DT_NODE_HAS_STATUS(DT_NODELABEL(veml6035), okay)
+static const struct sensor_chan_map veml6035_chans[] = {
+    {SENSOR_CHAN_LIGHT, 1, put_lux},
+};
+SENSOR_IODEV(veml6035, {SENSOR_CHAN_LIGHT, 0});
+#define JOB_VEML6035 SENSOR_JOB(veml6035, "VEML6035", fast_wq, \
+                                CONFIG_APP_LIGHT_PERIOD_MS, SENSOR_FLAG_LUX)
+#else
+#define JOB_VEML6035
+#endif
+
+#if DT_NODE_HAS_STATUS(DT_NODELABEL(si7210), okay)
+/* The driver reports Gauss; 1 G = 100 µT. The earth field (~0.44 G)
+ * lives entirely in the fractional part, which the scaling keeps. */
+static const struct sensor_chan_map si7210_chans[] = {
+    {SENSOR_CHAN_MAGN_Z, 100, put_mag},
+};
+SENSOR_IODEV(si7210, {SENSOR_CHAN_MAGN_Z, 0});
+#define JOB_SI7210 SENSOR_JOB(si7210, "Si7210", fast_wq, \
+                              CONFIG_APP_MAG_PERIOD_MS, SENSOR_FLAG_MAG)
+#else
+#define JOB_SI7210
+#endif
+
+/*
+ * Two work queues: the Si7021 runs in hold-master mode and blocks its
+ * queue for the whole conversion, so it gets its own (lower priority)
+ * queue and light/magnet work items are still dispatched on time. Only
+ * the queues are decoupled: all three sensors share i2c0, and the
+ * Si7021 holds the bus (clock stretching) until the conversion is done,
+ * so a light or magnet read that falls into it waits on the bus lock.
+ */
+#define FAST_WQ_PRIO K_PRIO_PREEMPT(5)
+#define SLOW_WQ_PRIO K_PRIO_PREEMPT(6)
+
+K_THREAD_STACK_DEFINE(fast_wq_stack, CONFIG_APP_SENSOR_WQ_STACK_SIZE);
+K_THREAD_STACK_DEFINE(slow_wq_stack, CONFIG_APP_SENSOR_WQ_STACK_SIZE);
+static struct k_work_q fast_wq;
+static struct k_work_q slow_wq;
+
+static struct sensor_job jobs[] = {
+    JOB_SI7021
+    JOB_VEML6035
+    JOB_SI7210
+};
+
+BUILD_ASSERT(ARRAY_SIZE(jobs) > 0, "no sensor node enabled in the devicetree");
+
+#ifdef CONFIG_APP_SENSOR_ASYNC
+/* Decode every channel of the job from one completed read (q31) */
+static int job_decode(const struct sensor_job *job, const uint8_t *buf,
+                      struct sensor_snapshot *val)
+{
+    const struct sensor_decoder_api *decoder;
+    int err = sensor_get_decoder(job->dev, &decoder);
+
+    if (err) {
+        return err;
+    }
+    for (size_t i = 0; i < job->chan_count; i++) {
+        const struct sensor_chan_map *c = &job->chans[i];
+        struct sensor_q31_data data = {0};
+        uint32_t fit = 0;
+
+        if (decoder->decode(buf, (struct sensor_chan_spec){c->chan, 0},
+                            &fit, 1, &data) <= 0) {
+            return -ENODATA;
+        }
+        c->put(val, (int32_t)(((int64_t)data.readings[0].value * c->scale) >>
+                              (31 - data.shift)));
+    }
+    return 0;
+}
+#else
+/* Fetch and convert; fills only this sensor's fields of *val */
+static int job_read(const struct sensor_job *job, struct sensor_snapshot *val)
+{
+    int err = sensor_sample_fetch(job->dev);
+
+    if (err) {
+        return err;
+    }
+    for (size_t i = 0; i < job->chan_count; i++) {
+        const struct sensor_chan_map *c = &job->chans[i];
+        struct sensor_value v;
+
+        err = sensor_channel_get(job->dev, c->chan, &v);
+        if (err) {
+            return err;
+        }
+        /* val2 is in millionths and carries the sign of the value */
+        c->put(val, (int32_t)((int64_t)v.val1 * c->scale +
+                              (int64_t)v.val2 * c->scale / 1000000));
+    }
+    return 0;
+}
+#endif /* CONFIG_APP_SENSOR_ASYNC */
+
+#ifdef CONFIG_APP_SENSOR_RAIL_GATING
+/*
+ * The rail is on while any job is sampling. Around each power cycle the
+ * sensors get PM_DEVICE_ACTION_TURN_OFF / TURN_ON so drivers that keep
+ * register state can restore it; a driver that refuses TURN_ON stays
+ * OFF and its reads fail (flag cleared) instead of returning garbage.
+ */
+static K_MUTEX_DEFINE(rail_lock);
+static unsigned int rail_users;
+
+static void rail_off(void)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(jobs); i++) {
+        (void)pm_device_action_run(jobs[i].dev, PM_DEVICE_ACTION_TURN_OFF);
+    }
+    regulator_disable(sensor_rail);
+}
+
+static int rail_get(void)
+{
+    int err = 0;
+
+    k_mutex_lock(&rail_lock, K_FOREVER);
+    if (rail_users == 0) {
+        err = regulator_enable(sensor_rail);
+        if (err == 0) {
+            /* Sensor power-up time and first conversion */
+            k_msleep(CONFIG_APP_SENSOR_RAIL_SETTLE_MS);
+            for (size_t i = 0; i < ARRAY_SIZE(jobs); i++) {
+                (void)pm_device_action_run(jobs[i].dev,
+                                           PM_DEVICE_ACTION_TURN_ON);
+            }
+        }
+    }
+    if (err == 0) {
+        rail_users++;
+    }
+    k_mutex_unlock(&rail_lock);
+    return err;
+}
+
+static void rail_put(void)
+{
+    k_mutex_lock(&rail_lock, K_FOREVER);
+    if (--rail_users == 0) {
+        rail_off();
+    }
+    k_mutex_unlock(&rail_lock);
+}
+#else
+static inline int rail_get(void)
+{
+    return 0;
+}
+
+static inline void rail_put(void)
+{
+}
+#endif /* CONFIG_APP_SENSOR_RAIL_GATING */
+
+/*
+ * Power the sensor and bus for one sample. Runtime PM calls are no-ops
+ * (return 0) unless the device has runtime PM enabled, i.e. in the
+ * low-power profile (zephyr,pm-device-runtime-auto).
+ */
+static int job_power_get(const struct sensor_job *job)
+{
+    int err = rail_get();
+
+    if (err) {
+        return err;
+    }
+    if (IS_ENABLED(CONFIG_APP_MAG_INTERRUPT) && job->flag == SENSOR_FLAG_MAG) {
+        mag_int_disarm();
+    }
+    err = pm_device_runtime_get(job->bus);
+    if (err == 0) {
+        err = pm_device_runtime_get(job->dev);
+        if (err) {
+            pm_device_runtime_put(job->bus);
+        }
+    }
+    if (err) {
+        rail_put();
+    }
+    return err;
+}
+
+static void job_power_put(const struct sensor_job *job)
+{
+    if (IS_ENABLED(CONFIG_APP_MAG_INTERRUPT) && job->flag == SENSOR_FLAG_MAG) {
+        mag_int_arm();
+    }
+    pm_device_runtime_put(job->dev);
+    pm_device_runtime_put(job->bus);
+    rail_put();
+}
+
+static void snapshot_store(const struct sensor_snapshot *val, uint8_t flag,
+                           bool ok)
+{
+    k_spinlock_key_t key = k_spin_lock(&snapshot_lock);
+    struct sensor_snapshot copy;
+
+    if (!ok) {
+        snapshot.flags &= ~flag;
+        k_spin_unlock(&snapshot_lock, key);
+        return;
+    }
+    if (flag & SENSOR_FLAG_TEMP_HUM) {
+        snapshot.temp_cdeg = val->temp_cdeg;
+        snapshot.hum_pct   = val->hum_pct;
+    }
+    if (flag & SENSOR_FLAG_LUX) {
+        snapshot.lux = val->lux;
+    }
+    if (flag & SENSOR_FLAG_MAG) {
+        snapshot.mag_ut = val->mag_ut;
+    }
+    snapshot.flags |= flag;
+    snapshot.sampled_ms = k_uptime_get_32();
+    copy = snapshot;
+    k_spin_unlock(&snapshot_lock, key);
+
+    if (sample_cb != NULL) {
+        sample_cb(flag, &copy);
+    }
+}
+
+#ifdef CONFIG_APP_SENSOR_ASYNC
+static void sensor_rtio_consumer(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    while (1) {
+        struct rtio_cqe *cqe = rtio_cqe_consume_block(&sensor_rtio);
+        struct sensor_job *job = cqe->userdata;
+        int result = cqe->result;
+        uint8_t *buf = NULL;
+        uint32_t buf_len = 0;
+
+        if (result == 0) {
+            result = rtio_cqe_get_mempool_buffer(&sensor_rtio, cqe,
+                                                 &buf, &buf_len);
+        }
+        rtio_cqe_release(&sensor_rtio, cqe);
+
+        if (result == 0) {
+            result = job_decode(job, buf, &job->os[job->os_count]);
+        }
+        if (buf != NULL) {
+            rtio_release_buffer(&sensor_rtio, buf, buf_len);
+        }
+        if (result == 0 && ++job->os_count < OVERSAMPLE) {
+            /* Oversampling: queue the next reading of the same sample */
+            result = sensor_read_async_mempool(job->iodev, &sensor_rtio, job);
+            if (result == 0) {
+                continue;
+            }
+        }
+        job_power_put(job);
+        if (result == 0 && IS_ENABLED(CONFIG_APP_FILTER)) {
+            filter_apply(job->flag, job->os, OVERSAMPLE, &job->os[0]);
+        }
+        snapshot_store(&job->os[0], job->flag, result == 0);
+        atomic_clear_bit(&job->busy, 0);
+    }
+}
+
+K_THREAD_DEFINE(sensor_rtio_tid, CONFIG_APP_SENSOR_WQ_STACK_SIZE,
+                sensor_rtio_consumer, NULL, NULL, NULL, FAST_WQ_PRIO, 0, 0);
+
+static void sensor_sample(struct sensor_job *job)
+{
+    /* Previous read still in flight: skip this slot, don't pile up */
+    if (atomic_test_and_set_bit(&job->busy, 0)) {
+        return;
+    }
+    if (job_power_get(job) != 0) {
+        atomic_clear_bit(&job->busy, 0);
+        snapshot_store(NULL, job->flag, false);
+        return;
+    }
+    job->os_count = 0;
+    if (sensor_read_async_mempool(job->iodev, &sensor_rtio, job) != 0) {
+        job_power_put(job);
+        atomic_clear_bit(&job->busy, 0);
+        snapshot_store(NULL, job->flag, false);
+    }
+}
+#else
+static void sensor_sample(struct sensor_job *job)
+{
+    struct sensor_snapshot val[OVERSAMPLE];
+    int err = job_power_get(job);
+
+    if (err == 0) {
+        for (size_t i = 0; i < OVERSAMPLE && err == 0; i++) {
+            err = job_read(job, &val[i]);
+        }
+        job_power_put(job);
+    }
+    if (err == 0 && IS_ENABLED(CONFIG_APP_FILTER)) {
+        filter_apply(job->flag, val, OVERSAMPLE, &val[0]);
+    }
+    snapshot_store(&val[0], job->flag, err == 0);
+}
+#endif /* CONFIG_APP_SENSOR_ASYNC */
+
+static void sensor_work_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct sensor_job *job = CONTAINER_OF(dwork, struct sensor_job, work);
+    /* Triggered samples (sensors_trigger) run early and keep the deadline */
+    bool due = k_uptime_get() >= job->next_ms;
+    int64_t now;
+
+    sensor_sample(job);
+    if (!due) {
+        k_work_reschedule_for_queue(job->queue, dwork,
+                                    K_TIMEOUT_ABS_MS(job->next_ms));
+        return;
+    }
+
+    /* Absolute deadlines so the period does not drift by fetch time;
+     * if we fell behind (e.g. bus contention) resync instead of bursting. */
+    job->next_ms += job->period_ms;
+    now = k_uptime_get();
+    if (job->next_ms <= now) {
+        job->next_ms = now + job->period_ms;
+    }
+    k_work_reschedule_for_queue(job->queue, dwork,
+                                K_TIMEOUT_ABS_MS(job->next_ms));
+}
+
+void sensors_start(sensors_sample_cb_t cb)
+{
+    sample_cb = cb;
+
+    k_work_queue_start(&fast_wq, fast_wq_stack,
+                       K_THREAD_STACK_SIZEOF(fast_wq_stack), FAST_WQ_PRIO,
+                       &(struct k_work_queue_config){.name = "sensor_fast"});
+    k_work_queue_start(&slow_wq, slow_wq_stack,
+                       K_THREAD_STACK_SIZEOF(slow_wq_stack), SLOW_WQ_PRIO,
+                       &(struct k_work_queue_config){.name = "sensor_slow"});
+
+#ifdef CONFIG_APP_SENSOR_RAIL_GATING
+    /* Drivers are initialised: drop the regulator-boot-on hold, from
+     * now on the sample jobs switch the rail */
+    rail_off();
+#endif
+
+    for (size_t i = 0; i < ARRAY_SIZE(jobs); i++) {
+        struct sensor_job *job = &jobs[i];
+
+        if (!device_is_ready(job->bus) || !device_is_ready(job->dev)) {
+            printk("%s not ready\n", job->name);
+            continue;
+        }
+        printk("%s: every %u ms\n", job->name, job->period_ms);
+        k_work_init_delayable(&job->work, sensor_work_handler);
+        job->next_ms = k_uptime_get();
+        if (IS_ENABLED(CONFIG_APP_MAG_INTERRUPT) && job->flag == SENSOR_FLAG_MAG &&
+            mag_int_init(job->queue) != 0) {
+            printk("%s: no threshold interrupt, polling only\n", job->name);
+        }
+        job->ready = true;
+        k_work_schedule_for_queue(job->queue, &job->work, K_NO_WAIT);
+    }
+}
+
+void sensors_trigger(uint8_t flag)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(jobs); i++) {
+        if (jobs[i].flag == flag && jobs[i].ready) {
+            k_work_reschedule_for_queue(jobs[i].queue, &jobs[i].work,
+                                        K_NO_WAIT);
+        }
+    }
+}
+
+void sensors_get_snapshot(struct sensor_snapshot *out)
+{
+    k_spinlock_key_t key = k_spin_lock(&snapshot_lock);
+
+    *out = snapshot;
+    k_spin_unlock(&snapshot_lock, key);
+}
@@ -0,0 +1,46 @@
+#ifndef SENSORS_H_
+#define SENSORS_H_
+
+#include <stdint.h>
+#include <zephyr/sys/util.h>
+
+/* snapshot.flags bits — mirrored 1:1 into BLE payload byte [7] */
+#define SENSOR_FLAG_TEMP_HUM BIT(0)
+#define SENSOR_FLAG_LUX      BIT(1)
+#define SENSOR_FLAG_MAG      BIT(2)
+
+/*
+ * Latest reading of every channel. Each sensor updates only its own
+ * fields at its own rate; a flag bit is cleared when that sensor's last
+ * fetch failed (value is then stale).
+ */
+struct sensor_snapshot {
+    int16_t  temp_cdeg;   /* centi-°C */
+    uint8_t  hum_pct;     /* %RH */
+    uint16_t lux;
+    int16_t  mag_ut;      /* µT */
+    uint8_t  flags;
+    uint32_t sampled_ms;  /* uptime of the newest successful reading */
+};
+
+/*
+ * Called from the sampling thread after each successful sample with the
+ * flag of the sensor that was just read and a copy of the new snapshot.
+ * Must not block for long: it delays that sensor's next sample.
+ */
+typedef void (*sensors_sample_cb_t)(uint8_t flag,
+                                    const struct sensor_snapshot *snap);
+
+/* Start the per-sensor sampling work items. cb may be NULL. */
+void sensors_start(sensors_sample_cb_t cb);
+
+/*
+ * Take the next sample of the sensor with this flag now instead of at
+ * its next period (e.g. from a GPIO interrupt). ISR-safe.
+ */
+void sensors_trigger(uint8_t flag);
+
+/* Copy the current snapshot (consistent across all fields). */
+void sensors_get_snapshot(struct sensor_snapshot *out);
+
+#endif /* SENSORS_H_ */
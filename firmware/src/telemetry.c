@@ -0,0 +1,194 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/ring_buf.h>
+
+#include "payload.h"
+#include "telemetry.h"
+
+/*
+ * Record, before framing:
+ *   [0]      uint8     record type (0x01 = sample)
+ *   [1–2]    uint16 LE sequence number (gaps = records dropped on TX)
+ *   [3–6]    uint32 LE uptime (ms)
+ *   [7]      uint8     sensor that was just sampled (flags bit)
+ *   [8–15]   snapshot, same 8-byte layout as the advertising payload
+ *   [16–17]  uint16 LE CRC-16/CCITT-FALSE over [0–15]
+ * On the wire: COBS-encoded record followed by a 0x00 delimiter, so a
+ * receiver resyncs on the next 0x00 after printk text or a lost byte.
+ */
+#define REC_TYPE_SAMPLE  PAYLOAD_TYPE_RECORD
+#define REC_LEN          PAYLOAD_RECORD_LEN
+#define FRAME_LEN        (REC_LEN + 2)
+/* COBS adds one code byte per 254 bytes, plus the delimiter */
+#define WIRE_MAX_LEN     (FRAME_LEN + 2)
+
+#define CMD_BINARY       'b'
+#define CMD_JSON         'j'
+#define RX_TIMEOUT_US    10000
+
+static const struct device *const uart = DEVICE_DT_GET(DT_CHOSEN(zephyr_console));
+
+RING_BUF_DECLARE(tx_ring, CONFIG_APP_TELEMETRY_BUF_SIZE);
+static struct k_spinlock tx_lock;
+static bool tx_busy;
+static bool ready;
+static uint16_t seq;
+static int64_t last_ms = -CONFIG_APP_TELEMETRY_MIN_INTERVAL_MS;
+static atomic_t json_mode = ATOMIC_INIT(!IS_ENABLED(CONFIG_APP_TELEMETRY_BINARY_DEFAULT));
+
+static uint8_t rx_buf[2][8];
+static uint8_t rx_next;
+
+/* Returns the encoded length including the trailing 0x00 */
+static size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    size_t code_pos = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (src[i] != 0) {
+            dst[out++] = src[i];
+            code++;
+        }
+        if (src[i] == 0 || code == 0xff) {
+            dst[code_pos] = code;
+            code_pos = out++;
+            code = 1;
+        }
+    }
+    dst[code_pos] = code;
+    dst[out++] = 0x00;
+    return out;
+}
+
+/* Start the next DMA transfer from the ring; caller holds tx_lock */
+static void tx_kick(void)
+{
+    uint8_t *data;
+    uint32_t len;
+
+    if (tx_busy) {
+        return;
+    }
+    len = ring_buf_get_claim(&tx_ring, &data, CONFIG_APP_TELEMETRY_BUF_SIZE);
+    if (len == 0) {
+        return;
+    }
+    if (uart_tx(uart, data, len, SYS_FOREVER_US) == 0) {
+        tx_busy = true;
+    } else {
+        ring_buf_get_finish(&tx_ring, 0);
+    }
+}
+
+static void uart_cb(const struct device *dev, struct uart_event *evt,
+                    void *user_data)
+{
+    k_spinlock_key_t key;
+
+    ARG_UNUSED(user_data);
+
+    switch (evt->type) {
+    case UART_TX_DONE:
+    case UART_TX_ABORTED:
+        key = k_spin_lock(&tx_lock);
+        ring_buf_get_finish(&tx_ring, evt->data.tx.len);
+        tx_busy = false;
+        tx_kick();
+        k_spin_unlock(&tx_lock, key);
+        break;
+    case UART_RX_RDY:
+        for (size_t i = 0; i < evt->data.rx.len; i++) {
+            uint8_t c = evt->data.rx.buf[evt->data.rx.offset + i];
+
+            if (c == CMD_BINARY) {
+                atomic_set(&json_mode, 0);
+            } else if (c == CMD_JSON) {
+                atomic_set(&json_mode, 1);
+            }
+        }
+        break;
+    case UART_RX_BUF_REQUEST:
+        uart_rx_buf_rsp(dev, rx_buf[rx_next], sizeof(rx_buf[0]));
+        rx_next ^= 1;
+        break;
+    case UART_RX_DISABLED:
+        uart_rx_enable(dev, rx_buf[rx_next], sizeof(rx_buf[0]), RX_TIMEOUT_US);
+        rx_next ^= 1;
+        break;
+    default:
+        break;
+    }
+}
+
+void telemetry_push(uint8_t flag, const struct sensor_snapshot *snap)
+{
+    uint8_t frame[FRAME_LEN];
+    uint8_t wire[WIRE_MAX_LEN];
+    int64_t now = k_uptime_get();
+    k_spinlock_key_t key;
+    size_t len;
+
+    if (!ready || atomic_get(&json_mode)) {
+        return;
+    }
+
+    /* Encoded under the lock so records enter the ring in seq order */
+    key = k_spin_lock(&tx_lock);
+    /* Every record carries the full snapshot, so a skipped one loses
+     * only its source marker, not data */
+    if (now - last_ms < CONFIG_APP_TELEMETRY_MIN_INTERVAL_MS) {
+        k_spin_unlock(&tx_lock, key);
+        return;
+    }
+    last_ms = now;
+    frame[0] = REC_TYPE_SAMPLE;
+    sys_put_le16(seq++, &frame[1]);
+    sys_put_le32((uint32_t)now, &frame[3]);
+    frame[7] = flag;
+    payload_put_sample(&frame[8], snap);
+    sys_put_le16(crc16_itu_t(0xffff, frame, REC_LEN), &frame[REC_LEN]);
+    len = cobs_encode(frame, sizeof(frame), wire);
+
+    /* Full: drop the record, the receiver sees a sequence gap */
+    if (ring_buf_space_get(&tx_ring) >= len) {
+        ring_buf_put(&tx_ring, wire, len);
+        tx_kick();
+    }
+    k_spin_unlock(&tx_lock, key);
+}
+
+bool telemetry_json(void)
+{
+    /* Fall back to the JSON line if the async UART could not be set up */
+    return !ready || atomic_get(&json_mode);
+}
+
+int telemetry_start(void)
+{
+    int err;
+
+    if (!device_is_ready(uart)) {
+        return -ENODEV;
+    }
+    err = uart_callback_set(uart, uart_cb, NULL);
+    if (err) {
+        printk("Telemetry: UART has no async API (%d)\n", err);
+        return err;
+    }
+    err = uart_rx_enable(uart, rx_buf[0], sizeof(rx_buf[0]), RX_TIMEOUT_US);
+    rx_next = 1;
+    if (err) {
+        /* TX still works; the mode just can't be switched */
+        printk("Telemetry: RX unavailable (%d)\n", err);
+    }
+    printk("Telemetry: %s mode ('b' binary, 'j' JSON)\n",
+           atomic_get(&json_mode) ? "JSON" : "binary");
+    ready = true;
+    return 0;
+}
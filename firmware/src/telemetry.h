@@ -0,0 +1,27 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensors.h"
+
+/*
+ * Binary sample telemetry on the console UART (CONFIG_APP_UART_TELEMETRY).
+ *
+ * Records are COBS-framed with a CRC and sent through the async UART
+ * API, so producers never wait for the line to drain. Sending 'b' or
+ * 'j' on the UART switches between binary records and the JSON debug
+ * line at runtime.
+ */
+
+/* Enable async TX/RX on the console UART. */
+int telemetry_start(void);
+
+/* Queue one binary record; rate-limited, drops when the TX buffer is full. */
+void telemetry_push(uint8_t flag, const struct sensor_snapshot *snap);
+
+/* True while the JSON debug line is selected instead of binary records. */
+bool telemetry_json(void);
+
+#endif /* TELEMETRY_H_ */
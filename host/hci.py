@@ -0,0 +1,231 @@
+"""
+Raw HCI LE scanner for Linux.
+
+Reads LE advertising reports straight off an HCI socket on the event loop,
+so each advertisement costs one recv() and a few slices instead of a trip
+through bluetoothd and D-Bus. Needs CAP_NET_RAW and CAP_NET_ADMIN (or
+root) and a Python built with Bluetooth socket support. Scanner raises
+SetupError when the socket cannot be opened or the controller refuses the
+legacy scan commands (e.g. after bluetoothd used extended scanning on a
+5.x controller), and the caller falls back to bleak.
+
+Only legacy advertising reports are decoded: boards in history mode
+(extended advertising) are not seen at all and need the bleak backend.
+"""
+
+import asyncio
+import socket
+import struct
+from typing import Any, Callable
+
+# Packet and event codes (Core spec Vol 4 Part E)
+HCI_COMMAND_PKT   = 0x01
+HCI_EVENT_PKT     = 0x04
+EVT_CMD_COMPLETE  = 0x0E
+EVT_CMD_STATUS    = 0x0F
+EVT_LE_META       = 0x3E
+LE_ADV_REPORT     = 0x02
+
+OP_LE_SET_SCAN_PARAMS = 0x200B  # OGF 0x08, OCF 0x000B
+OP_LE_SET_SCAN_ENABLE = 0x200C  # OGF 0x08, OCF 0x000C
+
+AD_NAME_SHORT = 0x08
+AD_NAME_FULL  = 0x09
+AD_MFR_DATA   = 0xFF
+
+COMMAND_TIMEOUT = 2.0  # seconds to wait for Command Complete
+
+# struct hci_filter: type mask, 64-bit event mask, opcode (padded to 16 bytes)
+_FILTER = struct.Struct("<IIIH2x")
+_SCAN_PARAMS = struct.Struct("<BHHBB")
+
+
+class SetupError(OSError):
+    """The scan could not be started: no socket, missing CAP_NET_ADMIN, or
+    a controller that rejects or does not answer the legacy commands."""
+
+
+class Device:
+    """The parts of bleak's BLEDevice that the bridge reads."""
+
+    __slots__ = ("address", "name")
+
+    def __init__(self, address: str, name: str | None) -> None:
+        self.address = address
+        self.name = name
+
+
+class Advertisement:
+    """The parts of bleak's AdvertisementData that the bridge reads."""
+
+    __slots__ = ("manufacturer_data", "rssi")
+
+    def __init__(self, manufacturer_data: dict[int, bytes], rssi: int) -> None:
+        self.manufacturer_data = manufacturer_data
+        self.rssi = rssi
+
+
+def available() -> bool:
+    return hasattr(socket, "AF_BLUETOOTH") and hasattr(socket, "BTPROTO_HCI")
+
+
+def open_socket(dev_id: int) -> socket.socket:
+    sock = socket.socket(socket.AF_BLUETOOTH, socket.SOCK_RAW, socket.BTPROTO_HCI)
+    try:
+        sock.bind((dev_id,))
+        # Only what the scanner consumes: command results and LE meta events
+        sock.setsockopt(socket.SOL_HCI, socket.HCI_FILTER, _FILTER.pack(
+            1 << HCI_EVENT_PKT,
+            (1 << EVT_CMD_COMPLETE) | (1 << EVT_CMD_STATUS),
+            1 << (EVT_LE_META - 32),
+            0))
+        sock.setblocking(False)
+    except OSError:
+        sock.close()
+        raise
+    return sock
+
+
+def parse_ad(data: bytes) -> tuple[str | None, dict[int, bytes]]:
+    """Local name and manufacturer data (by company ID) of one AD payload."""
+    name = None
+    mfr: dict[int, bytes] = {}
+    pos = 0
+    while pos < len(data):
+        length = data[pos]
+        if length == 0 or pos + 1 + length > len(data):
+            break
+        ad_type = data[pos + 1]
+        value = data[pos + 2:pos + 1 + length]
+        if ad_type == AD_MFR_DATA and len(value) >= 2:
+            mfr[value[0] | value[1] << 8] = value[2:]
+        elif ad_type in (AD_NAME_SHORT, AD_NAME_FULL):
+            name = value.decode("utf-8", "replace")
+        pos += 1 + length
+    return name, mfr
+
+
+def parse_reports(packet: bytes):
+    """Yield (address, ad data, rssi) per LE Advertising Report in a packet.
+
+    Reports are decoded one after another, as Linux does, rather than as
+    the per-field arrays of the spec; controllers send one per event.
+    """
+    if len(packet) < 5 or packet[1] != EVT_LE_META or packet[3] != LE_ADV_REPORT:
+        return
+    pos = 5
+    for _ in range(packet[4]):
+        if pos + 9 > len(packet):
+            return
+        addr = packet[pos + 2:pos + 8]
+        data_len = packet[pos + 8]
+        end = pos + 9 + data_len
+        if end >= len(packet):
+            return
+        rssi = packet[end] - 256 if packet[end] > 127 else packet[end]
+        yield ":".join(f"{b:02X}" for b in reversed(addr)), packet[pos + 9:end], rssi
+        pos = end + 1
+
+
+class Scanner:
+    """Async context manager that scans and calls callback(Device, Advertisement).
+
+    company_id drops reports without that manufacturer data before any
+    object is built. failed completes with the socket error if reading
+    stops, so the caller can restart.
+    """
+
+    def __init__(self, callback: Callable[[Device, Advertisement], Any], dev_id: int = 0,
+                 interval_ms: float = 100, window_ms: float = 100, active: bool = False,
+                 company_id: int | None = None) -> None:
+        self.callback = callback
+        self.dev_id = dev_id
+        self.interval = round(interval_ms / 0.625)
+        self.window = round(window_ms / 0.625)
+        self.active = active
+        self._company = company_id.to_bytes(2, "little") if company_id is not None else None
+        self._sock: socket.socket | None = None
+        self._loop: asyncio.AbstractEventLoop | None = None
+        self._commands: dict[int, asyncio.Future] = {}
+        self.failed: asyncio.Future | None = None
+
+    async def __aenter__(self) -> "Scanner":
+        self._loop = asyncio.get_running_loop()
+        self.failed = self._loop.create_future()
+        try:
+            self._sock = open_socket(self.dev_id)
+            self._loop.add_reader(self._sock.fileno(), self._on_readable)
+            # Disallowed while a scan runs, so stop whatever scan is active first
+            await self._command(OP_LE_SET_SCAN_ENABLE, b"\x00\x00", check=False)
+            await self._command(OP_LE_SET_SCAN_PARAMS, _SCAN_PARAMS.pack(
+                1 if self.active else 0, self.interval, self.window, 0, 0))
+            # Controller duplicate filtering is by address, so it stays off
+            await self._command(OP_LE_SET_SCAN_ENABLE, b"\x01\x00")
+        except (OSError, asyncio.TimeoutError) as exc:
+            self._close()
+            raise SetupError(f"hci{self.dev_id}: {str(exc) or 'no answer to a scan command'}") from exc
+        except BaseException:
+            self._close()
+            raise
+        return self
+
+    async def __aexit__(self, *exc) -> None:
+        try:
+            await self._command(OP_LE_SET_SCAN_ENABLE, b"\x00\x00", check=False)
+        except (OSError, asyncio.TimeoutError):
+            pass
+        finally:
+            self._close()
+
+    def _close(self) -> None:
+        if self._sock is not None:
+            self._loop.remove_reader(self._sock.fileno())
+            self._sock.close()
+            self._sock = None
+
+    async def _command(self, opcode: int, params: bytes, check: bool = True) -> None:
+        fut = self._commands[opcode] = self._loop.create_future()
+        self._sock.send(struct.pack("<BHB", HCI_COMMAND_PKT, opcode, len(params)) + params)
+        try:
+            status = await asyncio.wait_for(fut, COMMAND_TIMEOUT)
+        finally:
+            self._commands.pop(opcode, None)
+        if check and status:
+            raise OSError(f"HCI command 0x{opcode:04x} failed, status 0x{status:02x}")
+
+    def _on_readable(self) -> None:
+        while True:
+            try:
+                packet = self._sock.recv(260)
+                if not packet:
+                    raise ConnectionResetError("HCI socket closed")
+            except BlockingIOError:
+                return
+            except OSError as exc:
+                # Adapter gone or reset: let the caller restart the scan
+                self._loop.remove_reader(self._sock.fileno())
+                if not self.failed.done():
+                    self.failed.set_exception(exc)
+                return
+            if len(packet) < 3 or packet[0] != HCI_EVENT_PKT:
+                continue
+            event = packet[1]
+            if event == EVT_LE_META:
+                self._on_reports(packet)
+            elif event == EVT_CMD_COMPLETE and len(packet) >= 7:
+                self._resolve(packet[4] | packet[5] << 8, packet[6])
+            elif event == EVT_CMD_STATUS and len(packet) >= 7:
+                self._resolve(packet[5] | packet[6] << 8, packet[3])
+
+    def _resolve(self, opcode: int, status: int) -> None:
+        fut = self._commands.get(opcode)
+        if fut is not None and not fut.done():
+            fut.set_result(status)
+
+    def _on_reports(self, packet: bytes) -> None:
+        for address, data, rssi in parse_reports(packet):
+            # Cheap reject: the company ID follows an 0xFF AD type byte
+            if self._company is not None and b"\xff" + self._company not in data:
+                continue
+            name, mfr = parse_ad(data)
+            self.callback(Device(address, name), Advertisement(mfr, rssi))
@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+"""
+xG27 BLE payload formats — the single definition shared by host and firmware.
+
+The host imports this module to decode manufacturer data; the firmware
+build runs it as a script to generate ``payload_layout.h``:
+
+    python3 host/payload.py --header build/generated/payload_layout.h
+
+Frames are told apart by a leading type byte, except the original 8-byte
+sample payload, which predates versioning and is recognised by its length.
+"""
+
+import argparse
+import pathlib
+import struct
+from typing import Any, Callable
+
+# ── Sample ────────────────────────────────────────────────────────────────────
+#
+# 8-byte sample shared by the advertising payload, history frames, GATT
+# stream records, the flash log and UART telemetry.
+
+# (name, struct code, description); order is the wire order
+SAMPLE_FIELDS = (
+    ("temp",  "h", "int16 LE  temperature (centi-°C)"),
+    ("hum",   "B", "uint8     humidity (%RH)"),
+    ("lux",   "H", "uint16 LE ambient light (lux)"),
+    ("mag",   "h", "int16 LE  magnetic field (µT)"),
+    ("flags", "B", "uint8     sensor flags (bit0=temp/hum, bit1=lux, bit2=mag)"),
+)
+SAMPLE = struct.Struct("<" + "".join(code for _, code, _ in SAMPLE_FIELDS))
+SAMPLE_LEN = SAMPLE.size
+
+FLAG_TEMP = 0x01
+FLAG_LUX  = 0x02
+FLAG_MAG  = 0x04
+
+# ── Typed frames ──────────────────────────────────────────────────────────────
+
+TYPE_RECORD  = 0x01  # UART telemetry record (firmware telemetry.c)
+TYPE_HISTORY = 0x02  # extended-advertising history frame (firmware history.h)
+TYPE_TIMED   = 0x03  # legacy advertising sample with seq and time (firmware adv.c)
+
+# History frame header, followed by the newest sample and varint deltas:
+#   [0] type  [1] period (10 ms units)  [2–3] seq of newest  [4] count N
+HISTORY_HDR = struct.Struct("<BBHB")
+HISTORY_HDR_LEN = HISTORY_HDR.size + SAMPLE_LEN
+
+# UART telemetry record, before COBS framing; a CRC-16 LE follows it:
+#   [0] type  [1–2] seq  [3–6] uptime ms  [7] source flag  [8–15] sample
+RECORD_HDR = struct.Struct("<BHIB")
+RECORD_LEN = RECORD_HDR.size + SAMPLE_LEN
+
+# Timed advertising sample (CONFIG_APP_ADV_TIMING):
+#   [0] type  [1–2] seq, +1 per data update  [3–6] uptime ms of the reading
+#   [7–14] sample
+TIMED_HDR = struct.Struct("<BHI")
+TIMED_LEN = TIMED_HDR.size + SAMPLE_LEN
+
+
+def sample(temp_cdeg: int, hum: int, lux: int, mag: int, flags: int) -> dict[str, Any]:
+    return {
+        "t": round(temp_cdeg / 100.0, 2),
+        "h": hum,
+        "l": lux,
+        "m": float(mag),
+        "f": flags,
+    }
+
+
+def decode_sample(raw: bytes, offset: int = 0) -> dict[str, Any]:
+    return sample(*SAMPLE.unpack_from(raw, offset))
+
+
+def _varint(raw: bytes, pos: int) -> tuple[int, int]:
+    """Decode one zigzag LEB128 varint; returns (value, next position)."""
+    v = shift = 0
+    while True:
+        b = raw[pos]
+        pos += 1
+        v |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return (v >> 1) ^ -(v & 1), pos
+        shift += 7
+
+
+def decode_history(raw: bytes) -> list[dict[str, Any]] | None:
+    """Decode a history frame; N-1 older samples follow the newest one,
+    newest to oldest, as zigzag varint deltas of each field from the next
+    newer sample.
+
+    Returns the samples oldest first, each with "seq" and "p" (period ms).
+    """
+    if len(raw) < HISTORY_HDR_LEN:
+        return None
+    _, period, seq, count = HISTORY_HDR.unpack_from(raw)
+    cur = SAMPLE.unpack_from(raw, HISTORY_HDR.size)
+    samples = [cur]
+    pos = HISTORY_HDR_LEN
+    try:
+        while len(samples) < count:
+            older = []
+            for v in cur:
+                d, pos = _varint(raw, pos)
+                older.append(v + d)
+            samples.append(older)
+            cur = older
+    except IndexError:
+        pass  # truncated frame: keep what decoded cleanly
+    out = []
+    last = len(samples) - 1
+    for i, fields in enumerate(reversed(samples)):
+        d = sample(*fields)
+        d["seq"] = (seq - (last - i)) & 0xFFFF
+        d["p"] = period * 10
+        out.append(d)
+    return out
+
+
+def decode_record(raw: bytes) -> list[dict[str, Any]] | None:
+    """Decode a (COBS-decoded, CRC-checked) UART telemetry record."""
+    if len(raw) < RECORD_LEN:
+        return None
+    _, seq, uptime_ms, source = RECORD_HDR.unpack_from(raw)
+    d = decode_sample(raw, RECORD_HDR.size)
+    d["seq"] = seq
+    d["up"] = uptime_ms
+    d["src"] = source
+    return [d]
+
+
+def decode_timed(raw: bytes) -> list[dict[str, Any]] | None:
+    """Decode a timed advertising sample; adds "seq" and "up" (uptime ms)."""
+    if len(raw) < TIMED_LEN:
+        return None
+    _, seq, uptime_ms = TIMED_HDR.unpack_from(raw)
+    d = decode_sample(raw, TIMED_HDR.size)
+    d["seq"] = seq
+    d["up"] = uptime_ms
+    return [d]
+
+
+# Type byte → decoder; every decoder returns samples oldest first
+DECODERS: dict[int, Callable[[bytes], list[dict[str, Any]] | None]] = {
+    TYPE_RECORD:  decode_record,
+    TYPE_HISTORY: decode_history,
+    TYPE_TIMED:   decode_timed,
+}
+
+
+def decode(raw: bytes) -> list[dict[str, Any]] | None:
+    """Decode manufacturer data (company ID already stripped)."""
+    if len(raw) == SAMPLE_LEN:
+        return [decode_sample(raw)]
+    decoder = DECODERS.get(raw[0]) if raw else None
+    return decoder(raw) if decoder else None
+
+
+# ── C header generation ───────────────────────────────────────────────────────
+
+def _define(name: str, value: Any, comment: str = "") -> str:
+    line = f"#define {name:<24} {value}"
+    return f"{line:<40} /* {comment} */" if comment else line
+
+
+def c_header() -> str:
+    lines = [
+        "/* Generated by host/payload.py — do not edit. */",
+        "#ifndef PAYLOAD_LAYOUT_H_",
+        "#define PAYLOAD_LAYOUT_H_",
+        "",
+        "/* Sample field offsets */",
+    ]
+    offset = 0
+    for name, code, desc in SAMPLE_FIELDS:
+        lines.append(_define(f"PAYLOAD_OFF_{name.upper()}", offset, desc))
+        offset += struct.calcsize("<" + code)
+    lines += [
+        _define("PAYLOAD_SAMPLE_LEN", SAMPLE_LEN),
+        "",
+        _define("PAYLOAD_FLAG_TEMP", f"0x{FLAG_TEMP:02x}"),
+        _define("PAYLOAD_FLAG_LUX", f"0x{FLAG_LUX:02x}"),
+        _define("PAYLOAD_FLAG_MAG", f"0x{FLAG_MAG:02x}"),
+        "",
+        "/* Frame type bytes */",
+        _define("PAYLOAD_TYPE_RECORD", f"0x{TYPE_RECORD:02x}"),
+        _define("PAYLOAD_TYPE_HISTORY", f"0x{TYPE_HISTORY:02x}"),
+        _define("PAYLOAD_TYPE_TIMED", f"0x{TYPE_TIMED:02x}"),
+        "",
+        _define("PAYLOAD_HISTORY_HDR_LEN", HISTORY_HDR_LEN, "header + newest sample"),
+        _define("PAYLOAD_RECORD_LEN", RECORD_LEN, "before the CRC"),
+        _define("PAYLOAD_TIMED_HDR_LEN", TIMED_HDR.size, "before the sample"),
+        "",
+        "#endif /* PAYLOAD_LAYOUT_H_ */",
+        "",
+    ]
+    return "\n".join(lines)
+
+
+def main() -> None:
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    ap.add_argument("--header", type=pathlib.Path, required=True,
+                    help="write the C layout header here")
+    args = ap.parse_args()
+    text = c_header()
+    # Leave the file alone when unchanged so dependants are not rebuilt
+    if not args.header.exists() or args.header.read_text(encoding="utf-8") != text:
+        args.header.parent.mkdir(parents=True, exist_ok=True)
+        args.header.write_text(text, encoding="utf-8")
+
+
+if __name__ == "__main__":
+    main()
@@ -2,24 +2,41 @@
 """
 xG27 Sensor Dashboard Server
 
-- Scans for xG27-Sensor BLE advertisements (bleak)
+- Scans for xG27-Sensor BLE advertisements (bleak, or a raw HCI socket on Linux)
 - Serves a real-time HTML dashboard over HTTP/SSE on port 5555
 - Auto-reconnects BLE on failure
 """
 
+import argparse
 import asyncio
+import bisect
+import collections
+import functools
+import gzip
+import hashlib
+import itertools
 import json
 import logging
 import pathlib
-import queue
-import struct
-import subprocess
-import threading
-from http.server import BaseHTTPRequestHandler, HTTPServer
-from socketserver import ThreadingMixIn
+import socket
+import sys
+import time
+from http import HTTPStatus
 from typing import Any
+from urllib.parse import parse_qs, urlsplit
 
 from bleak import BleakScanner
+from bleak.assigned_numbers import AdvertisementDataType
+
+try:
+    import brotli  # optional; gzip only without it
+except ImportError:
+    brotli = None
+
+import hci
+import payload
+import sinks
+import store
 
 __version__ = "1.0.0"
 
@@ -32,171 +49,1060 @@ log = logging.getLogger(__name__)
 
 PORT             = 5555
 HTML_FILE        = pathlib.Path(__file__).parent / "sensor.html"
-DEVICE_NAME      = "xG27-Sensor"
+DB_FILE          = pathlib.Path(__file__).parent / "sensor_history.db"
+SPOOL_DIR        = pathlib.Path(__file__).parent / "spool"  # undelivered sink messages
+DEVICE_NAME      = "xG27-S"  # prefix: timed payloads advertise the shortened name
 COMPANY_ID       = 0xFFFF
-BLE_RETRY_DELAY  = 5    # seconds between reconnect attempts
+BLE_RETRY_MIN    = 0.1  # seconds before the first scanner restart; doubles per failure
+BLE_RETRY_MAX    = 30   # backoff ceiling
+BLE_RETRY_RESET  = 60   # a scan that ran this long restarts from BLE_RETRY_MIN again
+BLE_SILENCE      = 30   # seconds without any advertisement before an immediate rescan
+BLE_SILENCE_MAX  = 600  # ceiling; the window doubles per rescan that heard nothing
+# "passive" never sends scan requests; boards are recognised from the advertising
+# data alone. macOS only scans actively, so it always gets "active".
+SCAN_MODE        = "passive"
+SCAN_SERVICE_UUIDS: list[str] | None = None  # only report boards advertising one of these
+SCAN_RSSI_MIN: int | None = None  # BlueZ, active mode: drop weaker advertisements (dBm)
+SCAN_DUPLICATES  = True  # BlueZ, active mode: report unchanged repeats (fresh RSSI/last seen)
+# "hci" reads advertising reports from a raw HCI socket (Linux, CAP_NET_RAW),
+# "bleak" goes through the OS stack, "auto" picks hci when it can be opened
+SCAN_BACKEND     = "auto"
+HCI_DEVICE       = 0    # hciN
+SCAN_INTERVAL_MS = 100  # raw HCI only; window == interval scans continuously
+SCAN_WINDOW_MS   = 100
 SSE_HEARTBEAT    = 15   # seconds between keep-alive comments
+HISTORY_LEN      = 600  # samples kept per device in memory
+STORE_FLUSH      = 5    # seconds between batched history writes
+HISTORY_SPAN     = 3600 # default /history range when only part of it is given
+SSE_COALESCE     = False # default for /events without ?coalesce=
+SSE_QUEUE_LEN    = 64   # frames buffered per client; the oldest is dropped beyond
+SSE_STALL_TIMEOUT = 60  # seconds a client may refuse data before it is dropped
+SSE_KEYFRAME     = 30   # every Nth sample of a board goes to delta clients in full
+HTTP_TIMEOUT     = 10   # seconds to wait for a complete request head
+HTTP_MAX_HEADERS = 64
+GZIP_MIN_SIZE    = 512  # bytes; smaller bodies go out uncompressed
+GZIP_LEVEL       = 6
+LATENCY_WINDOW   = 1024 # most recent measurements kept per latency stage
+CLOCK_WINDOW     = 256  # frames per device used to estimate its clock offset
+UPTIME_WRAP_GAP  = 3600_000  # ms; an uptime wrap steps forward by less than this
+ECHO_TRACK       = 256  # newest sent frames that a dashboard echo can match
+SAMPLE_LOG_INTERVAL = 10  # seconds between per-board sample lines at DEBUG
+# Upper bounds (s) of the callback handling time histogram buckets
+CALLBACK_BUCKETS = (0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.1)
 
-latest: dict[str, Any] = {}
-_clients: list[queue.SimpleQueue[str]] = []
-_clients_lock = threading.Lock()
 
+class _Device:
+    """Current values and ring-buffered history of one board."""
 
-def _wifi_ip() -> str:
-    try:
-        r = subprocess.run(
-            ["ipconfig", "getifaddr", "en0"], capture_output=True, text=True
-        )
-        return r.stdout.strip() or "localhost"
-    except Exception:
-        return "localhost"
+    __slots__ = ("address", "latest", "history", "last_seq", "last_up", "last_seen",
+                 "last_raw", "frame", "received", "lost", "clock", "rssi", "logged",
+                 "unlogged")
+
+    def __init__(self, address: str) -> None:
+        self.address = address
+        self.latest: dict[str, Any] = {}
+        self.history: collections.deque[dict[str, Any]] = collections.deque(maxlen=HISTORY_LEN)
+        self.last_seq: int | None = None
+        self.last_up: int | None = None  # board uptime (ms) of the newest timed sample
+        self.last_seen = 0.0
+        self.last_raw = b""
+        self.frame: _Frame | None = None  # last broadcast, the keyframe for new clients
+        # Sequenced samples received and inferred lost from seq gaps
+        self.received = 0
+        self.lost = 0
+        # Recent (receive time − board uptime) in ms, see _latency
+        self.clock: collections.deque[float] = collections.deque(maxlen=CLOCK_WINDOW)
+        self.rssi: int | None = None
+        self.logged = 0.0   # time of the last sample log line
+        self.unlogged = 0   # samples since then
+
+    def summary(self) -> dict[str, Any]:
+        return {
+            "latest": self.latest,
+            "last_seen": round(self.last_seen, 3),
+            "samples": len(self.history),
+            "rssi": self.rssi,
+        }
+
+    def loss(self) -> dict[str, Any]:
+        total = self.received + self.lost
+        return {
+            "received": self.received,
+            "lost": self.lost,
+            "rate": round(self.lost / total, 4) if total else 0.0,
+        }
+
+
+# Only touched from the event loop (bleak callbacks and HTTP handlers run on
+# it), so no locking is needed.
+# Keyed by BLE address (a per-host UUID on macOS)
+_devices: dict[str, _Device] = {}
+# SSE subscribers by topic: a device address, or None for every device
+_clients: dict[str | None, list["_Subscriber"]] = {}
+_store = store.Store(DB_FILE)
+# --headless: no dashboard, so no SSE frames or history rows to build
+_headless = False
+# Output stages fed every new sample after the SSE broadcast
+_sinks: list[sinks.Sink] = []
+# Process-wide counters for /stats
+_stats: collections.Counter[str] = collections.Counter()
+_started = time.time()
+# SSE event ids; seeded from the clock so they keep growing across restarts
+_event_ids = itertools.count(int(_started * 1000))
+
+# Sliding windows (ms) of the sample → dashboard path, for /metrics:
+#   sample_rx  reading taken on the board → advertisement received. The
+#              board's uptime shares no epoch with this clock, so each
+#              device's offset is the smallest (receive − uptime) of its
+#              last CLOCK_WINDOW frames: this is the delay above the
+#              fastest delivery seen, mostly the advertising update
+#              period and interval.
+#   rx_send    advertisement received → frame written to an SSE client
+#   send_echo  first SSE send of a frame → the dashboard's /echo after
+#              painting it; includes the echo request's own trip
+LATENCY_STAGES = ("sample_rx", "rx_send", "send_echo")
+_latency = {stage: collections.deque(maxlen=LATENCY_WINDOW) for stage in LATENCY_STAGES}
+# Every measurement since start, for the summary's _count and _sum: [n, ms]
+_latency_total = {stage: [0, 0.0] for stage in LATENCY_STAGES}
+# Frame id → perf_counter() of its first SSE send, newest ECHO_TRACK only
+_sent_at: dict[int, float] = {}
+
+
+def _record_latency(stage: str, ms: float) -> None:
+    _latency[stage].append(ms)
+    total = _latency_total[stage]
+    total[0] += 1
+    total[1] += ms
+
+
+class _Histogram:
+    """Cumulative-on-export histogram of handling times (s)."""
+
+    __slots__ = ("counts", "sum", "count")
+
+    def __init__(self) -> None:
+        self.counts = [0] * len(CALLBACK_BUCKETS)
+        self.sum = 0.0
+        self.count = 0
+
+    def observe(self, seconds: float) -> None:
+        i = bisect.bisect_left(CALLBACK_BUCKETS, seconds)
+        if i < len(self.counts):
+            self.counts[i] += 1
+        self.sum += seconds
+        self.count += 1
+
+
+# Handling time per callback of the BLE → SSE path, for /metrics
+_callback_time: dict[str, _Histogram] = collections.defaultdict(_Histogram)
+
+
+def _timed(name: str):
+    """Record every call of the decorated function in _callback_time[name]."""
+    def wrap(fn):
+        @functools.wraps(fn)
+        def timed(*args, **kwargs):
+            t0 = time.perf_counter()
+            try:
+                return fn(*args, **kwargs)
+            finally:
+                _callback_time[name].observe(time.perf_counter() - t0)
+        return timed
+    return wrap
+
+
+def _lan_ip() -> str:
+    """Address of the interface that carries the default route.
+
+    Connecting a UDP socket only selects the route in the kernel; no
+    packet is sent, and the documentation address needs no network.
+    """
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+        try:
+            s.connect(("192.0.2.1", 9))
+            return s.getsockname()[0]
+        except OSError:
+            return "localhost"
+
+
+class _Subscriber:
+    """Pending SSE frames of one client.
+
+    Frames are _Frame objects built once per sample and shared by every
+    subscriber. A delta subscriber gets a frame's delta encoding only when
+    it was sent the previous sample of that board; after a drop, a
+    coalesced sample or a keyframe it gets the full frame again. Both
+    policies are bounded: by default at most SSE_QUEUE_LEN frames wait
+    and the oldest is dropped beyond that; a coalescing subscriber keeps only
+    the newest frame per device (latest wins). A subscriber that lost frames
+    since its last drain counts as lagging.
+    """
 
+    __slots__ = ("topic", "coalesce", "delta", "since", "sent", "dropped", "lagging",
+                 "_frames", "_latest", "_wake", "_last_n")
 
-def _broadcast(payload: str) -> None:
-    with _clients_lock:
-        for q in _clients:
-            q.put_nowait(payload)
+    def __init__(self, topic: str | None, coalesce: bool, delta: bool) -> None:
+        self.topic = topic
+        self.coalesce = coalesce
+        self.delta = delta
+        self.since = time.time()
+        self.sent = 0
+        self.dropped = 0
+        self.lagging = False
+        self._frames: collections.deque[_Frame] = collections.deque(maxlen=SSE_QUEUE_LEN)
+        self._latest: dict[str, _Frame] = {}
+        self._wake = asyncio.Event()
+        self._last_n: dict[str, int] = {}  # per board: n of the last frame sent
 
+    @property
+    def pending(self) -> int:
+        return len(self._frames) + len(self._latest)
 
-def _parse(raw: bytes) -> dict[str, Any] | None:
-    """Parse the 8-byte BLE manufacturer payload (company ID already stripped).
+    def push(self, frame: "_Frame") -> None:
+        if self.coalesce:
+            # pop first to keep arrival order across devices
+            replaced = self._latest.pop(frame.address, None) is not None
+            self._latest[frame.address] = frame
+        else:
+            replaced = len(self._frames) == self._frames.maxlen
+            self._frames.append(frame)
+        if replaced:
+            if not self.lagging:
+                self.lagging = True
+                _stats["lag_events"] += 1
+            self.dropped += 1
+            _stats["frames_coalesced" if self.coalesce else "frames_dropped"] += 1
+        self._wake.set()
+
+    def stats(self) -> dict[str, Any]:
+        return {
+            "topic": self.topic,
+            "coalesce": self.coalesce,
+            "delta": self.delta,
+            "connected_s": round(time.time() - self.since, 1),
+            "sent": self.sent,
+            "dropped": self.dropped,
+            "pending": self.pending,
+            "lagging": self.lagging,
+        }
+
+    def encode(self, frame: "_Frame") -> bytes:
+        """Bytes to send for frame; records it as the board's last sample."""
+        last = self._last_n.get(frame.address)
+        self._last_n[frame.address] = frame.n
+        if self.delta and frame.delta is not None and last == frame.n - 1:
+            return frame.delta
+        return frame.full
+
+    async def drain(self, timeout: float) -> list[bytes]:
+        """Wait up to timeout for frames; returns all pending, oldest first."""
+        if not self._frames and not self._latest:
+            self._wake.clear()
+            try:
+                await asyncio.wait_for(self._wake.wait(), timeout)
+            except asyncio.TimeoutError:
+                return []
+        pending = (*self._frames, *self._latest.values())
+        _mark_sent(pending)
+        frames = [self.encode(f) for f in pending]
+        self._frames.clear()
+        self._latest.clear()
+        self.lagging = False
+        self.sent += len(frames)
+        _stats["frames_sent"] += len(frames)
+        return frames
 
-    Layout:
-      [0–1]  int16 LE   temperature (centi-°C)
-      [2]    uint8      humidity (%RH)
-      [3–4]  uint16 LE  ambient light (lux)
-      [5–6]  int16 LE   magnetic field (µT)
-      [7]    uint8      sensor flags  bit0=temp/hum  bit1=lux  bit2=mag
+
+class _Frame:
+    """One sample of one board, SSE-encoded once for every subscriber.
+
+    n counts the board's samples; full is a plain message with the whole
+    sample, delta an "event: delta" message with only the fields that
+    changed since sample n-1 (None for keyframes).
     """
-    if len(raw) < 8:
-        return None
-    temp_cdeg = struct.unpack_from("<h", raw, 0)[0]
-    hum       = raw[2]
-    lux       = struct.unpack_from("<H", raw, 3)[0]
-    mag       = struct.unpack_from("<h", raw, 5)[0]
-    flags     = raw[7]
+
+    __slots__ = ("address", "n", "id", "sample", "rx", "sent", "full", "delta")
+
+    def __init__(self, address: str, n: int, sample: dict[str, Any],
+                 prev: dict[str, Any] | None, rx: float) -> None:
+        self.address = address
+        self.n = n
+        self.id = next(_event_ids)
+        self.sample = sample
+        self.rx = rx        # perf_counter() when the advertisement arrived
+        self.sent = False   # written to at least one client
+        head = b"id: %d\n" % self.id
+        self.full = head + b"data: " + json.dumps(sample).encode() + b"\n\n"
+        self.delta = None
+        if prev is not None and n % SSE_KEYFRAME:
+            changed = {k: v for k, v in sample.items() if prev.get(k) != v}
+            changed["d"] = address
+            self.delta = (head + b"event: delta\ndata: " +
+                          json.dumps(changed).encode() + b"\n\n")
+
+
+@_timed("broadcast")
+def _broadcast(frame: _Frame) -> None:
+    for topic in (None, frame.address):
+        for sub in _clients.get(topic, ()):
+            sub.push(frame)
+
+
+def _mark_sent(frames: tuple[_Frame, ...]) -> None:
+    """Record rx → send for frames leaving a subscriber queue."""
+    now = time.perf_counter()
+    for f in frames:
+        _record_latency("rx_send", (now - f.rx) * 1000)
+        if not f.sent:
+            f.sent = True
+            _sent_at[f.id] = now
+            if len(_sent_at) > ECHO_TRACK:
+                del _sent_at[next(iter(_sent_at))]
+
+
+def _percentiles(values: collections.deque[float]) -> dict[str, Any]:
+    if not values:
+        return {"n": 0}
+    s = sorted(values)
+    rank = {q: s[min(len(s) - 1, int(q / 100 * len(s)))] for q in (50, 95, 99)}
     return {
-        "t": round(temp_cdeg / 100.0, 2),
-        "h": int(hum),
-        "l": int(lux),
-        "m": float(mag),
-        "f": int(flags),
+        "n": len(s),
+        **{f"p{q}": round(v, 2) for q, v in rank.items()},
+        "max": round(s[-1], 2),
     }
 
 
+def _is_newer(seq: int, last: int | None) -> bool:
+    return last is None or 0 < ((seq - last) & 0xFFFF) < 0x8000
+
+
+def _rebooted(up: int, last_up: int) -> bool:
+    """Uptime went backwards, other than by its 32-bit wrap after 49.7 days."""
+    return up < last_up and (up - last_up) & 0xFFFFFFFF > UPTIME_WRAP_GAP
+
+
 # ── BLE ───────────────────────────────────────────────────────────────────────
 
-async def _ble_scan() -> None:
-    log.info("BLE scan started — looking for '%s'", DEVICE_NAME)
+def _log_sample(dev: _Device, fresh: list[dict[str, Any]], now: float) -> None:
+    """One DEBUG line per board every SAMPLE_LOG_INTERVAL at most."""
+    dev.unlogged += len(fresh)
+    if now - dev.logged < SAMPLE_LOG_INTERVAL or not log.isEnabledFor(logging.DEBUG):
+        return
+    d = fresh[-1]
+    log.debug(
+        "%s t=%.2f°C  h=%d%%  l=%d lux  m=%.1f µT  f=%d  (%d sample(s) since last line)",
+        dev.address, d["t"], d["h"], d["l"], d["m"], d["f"], dev.unlogged,
+    )
+    dev.logged = now
+    dev.unlogged = 0
+
 
-    def on_adv(device, adv):
-        if device.name != DEVICE_NAME:
+@_timed("on_adv")
+def _on_adv(device, adv) -> None:
+    if not (device.name or "").startswith(DEVICE_NAME):
+        return
+    raw = adv.manufacturer_data.get(COMPANY_ID, b"")
+    rx = time.perf_counter()
+    now = time.time()
+    _stats["adv_received"] += 1
+    dev = _devices.get(device.address)
+    if dev is not None:
+        dev.last_seen = now
+        dev.rssi = adv.rssi
+        # The OS reports each advertisement several times per interval;
+        # an unchanged payload has nothing new to parse or broadcast
+        if raw == dev.last_raw:
+            _stats["adv_duplicates"] += 1
             return
-        raw = adv.manufacturer_data.get(COMPANY_ID, b"")
-        data = _parse(raw)
-        if data is None:
+    samples = payload.decode(raw)
+    if not samples:
+        return
+
+    if dev is None:
+        dev = _devices[device.address] = _Device(device.address)
+        dev.last_seen = now
+        dev.rssi = adv.rssi
+        log.info("new device %s (%d tracked)", device.address, len(_devices))
+    dev.last_raw = raw
+    if "seq" in samples[-1]:
+        newest = samples[-1]["seq"]
+        up = samples[-1].get("up")
+        if up is not None:
+            rebooted = dev.last_up is not None and _rebooted(up, dev.last_up)
+        else:
+            # History frames carry no uptime: a newest seq far behind the
+            # last one seen is the best sign of a reboot there
+            rebooted = (dev.last_seq is not None and
+                        255 < ((dev.last_seq - newest) & 0xFFFF) < 0x8000)
+        if rebooted:
+            # The seq restarted: neither a duplicate nor a gap to count as loss
+            dev.last_seq = None
+            dev.clock.clear()
+        # Consecutive frames overlap; only forward samples not seen yet
+        fresh = [d for d in samples if _is_newer(d["seq"], dev.last_seq)]
+        if not fresh:
             return
-        global latest
-        latest = data
-        log.info(
-            "t=%.2f°C  h=%d%%  l=%d lux  m=%.1f µT  f=%d",
-            data["t"], data["h"], data["l"], data["m"], data["f"],
-        )
-        _broadcast(json.dumps(data))
+        if dev.last_seq is not None:
+            dev.lost += ((fresh[0]["seq"] - dev.last_seq) & 0xFFFF) - 1
+        dev.received += len(fresh)
+        dev.last_seq = fresh[-1]["seq"]
+        for d in fresh:
+            # Timed advertisements carry one sample and no period
+            d["ts"] = round(now - ((newest - d["seq"]) & 0xFFFF) * d.get("p", 0) / 1000, 3)
+        if up is not None:
+            dev.last_up = up
+            dev.clock.append(now * 1000 - up)
+            _record_latency("sample_rx", dev.clock[-1] - min(dev.clock))
+    else:
+        fresh = samples
+        fresh[0]["ts"] = round(now, 3)
+    for d in fresh:
+        d["d"] = dev.address
+        dev.history.append(d)
+        if not _headless:
+            _store.add(dev.address, d)
+    dev.latest = fresh[-1]
+
+    _log_sample(dev, fresh, now)
+    for d in fresh:
+        if not _headless:
+            prev = dev.frame
+            dev.frame = _Frame(dev.address, prev.n + 1 if prev else 0, d,
+                               prev.sample if prev else None, rx)
+            _broadcast(dev.frame)
+        for sink in _sinks:
+            sink.add(dev.address, d)
+
+
+def _scanner_args() -> dict[str, Any]:
+    """BleakScanner arguments from the SCAN_* settings.
+
+    Filters run below the Python callback wherever the backend allows:
+    BlueZ matches the company ID in bluetoothd (an advertisement monitor
+    in passive mode, a discovery filter otherwise) and CoreBluetooth /
+    WinRT apply the service UUID list in the OS.
+    """
+    mode = "active" if sys.platform == "darwin" else SCAN_MODE
+    filters: dict[str, Any] = {"Transport": "le", "DuplicateData": SCAN_DUPLICATES}
+    if SCAN_RSSI_MIN is not None:
+        filters["RSSI"] = SCAN_RSSI_MIN
+    return {
+        "service_uuids": SCAN_SERVICE_UUIDS,
+        "scanning_mode": mode,
+        "bluez": {
+            "filters": filters,
+            # Manufacturer data starts with the little-endian company ID
+            "or_patterns": [(0, AdvertisementDataType.MANUFACTURER_SPECIFIC_DATA,
+                             COMPANY_ID.to_bytes(2, "little"))],
+        },
+    }
+
 
-    async with BleakScanner(on_adv):
-        await asyncio.Future()
+class _ScanSilent(Exception):
+    """No advertisement for the silence window; the scan is restarted at once."""
 
 
-async def ble_loop() -> None:
+async def _watch_silence(failed: asyncio.Future, silence: float) -> None:
+    """Raise once the scanner failed or, after a board has been heard,
+    nothing arrived for silence seconds of this scan (_ScanSilent; some
+    stacks stop reporting without raising). Until this scan hears a board
+    the window is silence, from then on BLE_SILENCE."""
+    started = time.time()
     while True:
         try:
-            await _ble_scan()
+            await asyncio.wait_for(asyncio.shield(failed), BLE_SILENCE / 4)
+        except asyncio.TimeoutError:
+            pass
+        last = max((d.last_seen for d in _devices.values()), default=None)
+        if last is None:
+            continue
+        # A board heard in this scan brings back the normal window
+        window = BLE_SILENCE if last >= started else silence
+        if time.time() - max(last, started) > window:
+            raise _ScanSilent(f"no advertisement for {window:g} s")
+
+
+async def _bleak_scan(silence: float) -> None:
+    args = _scanner_args()
+    log.info("BLE scan started (%s) — looking for '%s'", args["scanning_mode"], DEVICE_NAME)
+    async with BleakScanner(_on_adv, **args):
+        await _watch_silence(asyncio.get_running_loop().create_future(), silence)
+
+
+async def _hci_scan(silence: float) -> None:
+    scanner = hci.Scanner(_on_adv, HCI_DEVICE, SCAN_INTERVAL_MS, SCAN_WINDOW_MS,
+                          active=SCAN_MODE == "active", company_id=COMPANY_ID)
+    async with scanner:
+        log.info("BLE scan started (raw HCI hci%d, %s, legacy advertising only: boards in"
+                 " history mode need --scanner bleak) — looking for '%s'",
+                 HCI_DEVICE, SCAN_MODE, DEVICE_NAME)
+        await _watch_silence(scanner.failed, silence)
+
+
+def _scan_backend(backend: str) -> str:
+    if backend != "auto":
+        return backend
+    if sys.platform.startswith("linux") and hci.available():
+        try:
+            hci.open_socket(HCI_DEVICE).close()
+            return "hci"
+        except OSError as exc:
+            log.info("raw HCI unavailable (%s); scanning through bleak", exc)
+    return "bleak"
+
+
+async def ble_loop(backend: str = SCAN_BACKEND) -> None:
+    scan = _hci_scan if _scan_backend(backend) == "hci" else _bleak_scan
+    delay = BLE_RETRY_MIN
+    silence = BLE_SILENCE
+    while True:
+        started = time.monotonic()
+        heard = _stats["adv_received"]
+        try:
+            await scan(silence)
+        except _ScanSilent as exc:
+            # The scan itself ran fine. One that heard boards before going
+            # quiet had stalled; one that heard nothing at all most likely
+            # has no board in range, so wait longer before the next rescan
+            _stats["scan_restarts"] += 1
+            log.warning("BLE scan: %s — restarting", exc)
+            delay = BLE_RETRY_MIN
+            if _stats["adv_received"] == heard:
+                silence = min(silence * 2, BLE_SILENCE_MAX)
+            else:
+                silence = BLE_SILENCE
         except Exception as exc:
-            log.error("BLE error: %s — retry in %ds", exc, BLE_RETRY_DELAY)
-            await asyncio.sleep(BLE_RETRY_DELAY)
+            # Opening the socket proves little: the scan commands can still
+            # be refused (no CAP_NET_ADMIN, extended scanning in use)
+            if isinstance(exc, hci.SetupError) and backend == "auto":
+                log.warning("raw HCI scan refused (%s); scanning through bleak", exc)
+                scan = _bleak_scan
+                continue
+            if time.monotonic() - started >= BLE_RETRY_RESET:
+                delay = BLE_RETRY_MIN
+            _stats["scan_restarts"] += 1
+            log.error("BLE error: %s — retry in %.1fs", exc, delay)
+            await asyncio.sleep(delay)
+            delay = min(delay * 2, BLE_RETRY_MAX)
 
 
 # ── HTTP / SSE ────────────────────────────────────────────────────────────────
+#
+# A minimal HTTP/1.1 server on the same event loop as the BLE scanner: each
+# connection is a coroutine, and broadcasts fan out through one _Subscriber
+# per SSE client, so hundreds of dashboards cost no threads.
 
-class _Handler(BaseHTTPRequestHandler):
-    def log_message(self, fmt, *args):
-        pass  # silence per-request access log
+SSE_HEARTBEAT_FRAME = b": heartbeat\n\n"  # prevent proxy / browser timeout
+STATS_COUNTERS = ("adv_received", "adv_duplicates", "scan_restarts", "clients_total",
+                  "clients_stalled", "frames_sent", "frames_dropped", "frames_coalesced",
+                  "lag_events")
 
-    def do_GET(self):
-        if self.path in ("/", "/sensor.html"):
-            self._serve_html()
-        elif self.path == "/events":
-            self._serve_sse()
-        else:
-            self.send_error(404)
+class _HTTPError(Exception):
+    def __init__(self, status: HTTPStatus, message: str = "") -> None:
+        super().__init__(message)
+        self.status = status
+        self.message = message or status.phrase
 
-    def _serve_html(self):
-        try:
-            body = HTML_FILE.read_bytes()
-        except FileNotFoundError:
-            self.send_error(404)
+
+class _Request:
+    __slots__ = ("method", "path", "query", "headers")
+
+    def __init__(self, method: str, target: str, headers: dict[str, str]) -> None:
+        url = urlsplit(target)
+        self.method = method
+        self.path = url.path
+        self.query = parse_qs(url.query)
+        self.headers = headers
+
+    def arg(self, name: str) -> str | None:
+        return self.query.get(name, [None])[0]
+
+
+async def _read_line(reader: asyncio.StreamReader, too_long: HTTPStatus) -> bytes:
+    try:
+        return await asyncio.wait_for(reader.readline(), HTTP_TIMEOUT)
+    except ValueError:
+        # readline() turns LimitOverrunError into ValueError; the line is
+        # beyond the stream limit (64 KiB)
+        raise _HTTPError(too_long)
+
+
+async def _read_request(reader: asyncio.StreamReader) -> _Request | None:
+    line = await _read_line(reader, HTTPStatus.REQUEST_URI_TOO_LONG)
+    if not line:
+        return None  # client opened and closed without a request
+    try:
+        method, target, _ = line.decode("latin-1").split(None, 2)
+    except ValueError:
+        raise _HTTPError(HTTPStatus.BAD_REQUEST)
+    headers = {}
+    while True:
+        line = await _read_line(reader, HTTPStatus.REQUEST_HEADER_FIELDS_TOO_LARGE)
+        if line in (b"\r\n", b"\n", b""):
+            break
+        if len(headers) >= HTTP_MAX_HEADERS:
+            raise _HTTPError(HTTPStatus.REQUEST_HEADER_FIELDS_TOO_LARGE)
+        name, _, value = line.decode("latin-1").partition(":")
+        headers[name.strip().lower()] = value.strip()
+    return _Request(method, target, headers)
+
+
+def _head(status: HTTPStatus, headers: dict[str, str]) -> bytes:
+    lines = [f"HTTP/1.1 {status.value} {status.phrase}"]
+    lines += [f"{k}: {v}" for k, v in headers.items()]
+    return ("\r\n".join(lines) + "\r\n\r\n").encode("latin-1")
+
+
+async def _respond(writer: asyncio.StreamWriter, body: bytes, content_type: str,
+                   status: HTTPStatus = HTTPStatus.OK, **extra: str) -> None:
+    headers = {
+        "Content-Type": content_type,
+        "Content-Length": str(len(body)),
+        "Connection": "close",
+    }
+    headers.update({k.replace("_", "-"): v for k, v in extra.items()})
+    writer.write(_head(status, headers) + body)
+    await writer.drain()
+
+
+async def _send_json(writer: asyncio.StreamWriter, obj: Any) -> None:
+    await _respond(writer, json.dumps(obj).encode(), "application/json",
+                   Access_Control_Allow_Origin="*")
+
+
+class _Asset:
+    """A static file cached in memory with its compressed variants.
+
+    The file is stat()ed on each request and re-read only when its mtime or
+    size changed, so edits to sensor.html show up without a restart.
+    """
+
+    def __init__(self, path: pathlib.Path, content_type: str) -> None:
+        self.path = path
+        self.content_type = content_type
+        self._key: tuple[int, int] | None = None
+        self.etag = ""
+        self.variants: dict[str, bytes] = {}  # content-coding → body
+
+    def load(self) -> None:
+        st = self.path.stat()
+        key = (st.st_mtime_ns, st.st_size)
+        if key == self._key:
             return
-        self.send_response(200)
-        self.send_header("Content-Type", "text/html; charset=utf-8")
-        self.send_header("Content-Length", str(len(body)))
-        self.end_headers()
-        self.wfile.write(body)
-
-    def _serve_sse(self):
-        self.send_response(200)
-        self.send_header("Content-Type",  "text/event-stream")
-        self.send_header("Cache-Control", "no-cache")
-        self.send_header("Connection",    "keep-alive")
-        self.send_header("Access-Control-Allow-Origin", "*")
-        self.end_headers()
-
-        q: queue.SimpleQueue[str] = queue.SimpleQueue()
-        with _clients_lock:
-            _clients.append(q)
-
-        if latest:
-            try:
-                self.wfile.write(f"data: {json.dumps(latest)}\n\n".encode())
-                self.wfile.flush()
-            except Exception:
-                pass
+        body = self.path.read_bytes()
+        self.variants = {"identity": body, "gzip": gzip.compress(body, 9)}
+        if brotli is not None:
+            self.variants["br"] = brotli.compress(body)
+        self.etag = '"%s"' % hashlib.sha1(body).hexdigest()[:16]
+        self._key = key
 
-        try:
-            while True:
-                try:
-                    msg = q.get(timeout=SSE_HEARTBEAT)
-                    line = f"data: {msg}\n\n"
-                except queue.Empty:
-                    line = ": heartbeat\n\n"  # prevent proxy / browser timeout
-                self.wfile.write(line.encode())
-                self.wfile.flush()
-        except Exception:
-            pass
-        finally:
-            with _clients_lock:
-                try:
-                    _clients.remove(q)
-                except ValueError:
-                    pass
+    def pick(self, accept_encoding: str) -> str:
+        offered = {c.split(";")[0].strip() for c in accept_encoding.split(",")}
+        for coding in ("br", "gzip"):
+            if coding in offered and coding in self.variants:
+                return coding
+        return "identity"
+
+
+_html = _Asset(HTML_FILE, "text/html; charset=utf-8")
+
+
+async def _serve_html(req: _Request, writer: asyncio.StreamWriter) -> None:
+    try:
+        _html.load()
+    except FileNotFoundError:
+        raise _HTTPError(HTTPStatus.NOT_FOUND)
+    # no-cache: the browser keeps its copy but revalidates every load
+    cache = {"ETag": _html.etag, "Cache-Control": "no-cache", "Vary": "Accept-Encoding"}
+    match = req.headers.get("if-none-match", "")
+    if _html.etag in (m.strip().removeprefix("W/") for m in match.split(",")):
+        writer.write(_head(HTTPStatus.NOT_MODIFIED, {**cache, "Connection": "close"}))
+        await writer.drain()
+        return
+    coding = _html.pick(req.headers.get("accept-encoding", ""))
+    if coding != "identity":
+        cache["Content-Encoding"] = coding
+    await _respond(writer, _html.variants[coding], _html.content_type,
+                   **{k.replace("-", "_"): v for k, v in cache.items()})
+
+
+async def _serve_devices(req: _Request, writer: asyncio.StreamWriter) -> None:
+    await _send_json(writer, {a: d.summary() for a, d in _devices.items()})
+
+
+def _sample_rate(address: str | None) -> float:
+    """Samples/s of a board over its in-memory history, for res=auto."""
+    dev = _devices.get(address)
+    if dev is None or len(dev.history) < 2:
+        return store.RATE_GUESS
+    # Backfilled history samples are not in time order
+    ts = [s["ts"] for s in dev.history]
+    span = max(ts) - min(ts)
+    return (len(ts) - 1) / span if span > 0 else store.RATE_GUESS
 
 
-class _Server(ThreadingMixIn, HTTPServer):
-    allow_reuse_address = True
-    daemon_threads = True
+def _history_range(req: _Request) -> tuple[float, float, int]:
+    """Parse from/to (unix s) and res (raw, 60, 3600 or auto) of /history."""
+    try:
+        end = float(req.arg("to") or time.time())
+        start = float(req.arg("from") or end - HISTORY_SPAN)
+    except ValueError:
+        raise _HTTPError(HTTPStatus.BAD_REQUEST, "from/to must be unix seconds")
+    res = req.arg("res") or "auto"
+    if res == "auto":
+        return start, end, store.auto_resolution(end - start, _sample_rate(req.arg("device")))
+    if res == "raw":
+        return start, end, store.RES_RAW
+    if res.isdigit() and int(res) in store.RESOLUTIONS:
+        return start, end, int(res)
+    raise _HTTPError(HTTPStatus.BAD_REQUEST, "res must be raw, 60, 3600 or auto")
+
+
+async def _serve_history(req: _Request, writer: asyncio.StreamWriter) -> None:
+    device = req.arg("device")
+    if device is None:
+        raise _HTTPError(HTTPStatus.BAD_REQUEST, "device parameter required")
+    if not {"from", "to", "res"} & req.query.keys():
+        # No range: the in-memory buffer of the running session
+        dev = _devices.get(device)
+        if dev is None:
+            raise _HTTPError(HTTPStatus.NOT_FOUND, "unknown device")
+        await _send_json(writer, list(dev.history))
+        return
+    start, end, res = _history_range(req)
+    # Samples still waiting for the next batch would be missing otherwise
+    await _store.flush()
+    points = await _store.query(device, start, end, res)
+    await _send_json(writer, {
+        "device": device,
+        "from": start,
+        "to": end,
+        "res": "raw" if res == store.RES_RAW else res,
+        "points": points,
+    })
+
+
+async def _serve_history_bin(req: _Request, writer: asyncio.StreamWriter) -> None:
+    device = req.arg("device")
+    if device is None:
+        raise _HTTPError(HTTPStatus.BAD_REQUEST, "device parameter required")
+    channels = (req.arg("ch") or "t,h,l,m").split(",")
+    if not set(channels) <= store.PACK_CHANNELS.keys():
+        raise _HTTPError(HTTPStatus.BAD_REQUEST, "ch must be a list of t, h, l, m")
+    agg = req.arg("agg") or "avg"
+    if agg not in store.AGGREGATES:
+        raise _HTTPError(HTTPStatus.BAD_REQUEST, "agg must be min, avg or max")
+    start, end, res = _history_range(req)
+    await _store.flush()
+    points = await _store.query(device, start, end, res)
+    body = store.pack(points, res, channels, agg, req.arg("delta") == "1")
+    extra = {"Access_Control_Allow_Origin": "*", "X_Resolution": str(res)}
+    if len(body) > GZIP_MIN_SIZE and "gzip" in req.headers.get("accept-encoding", ""):
+        body = gzip.compress(body, GZIP_LEVEL)
+        extra["Content_Encoding"] = "gzip"
+    await _respond(writer, body, "application/octet-stream", Vary="Accept-Encoding", **extra)
+
+
+async def _sse_send(writer: asyncio.StreamWriter, data: bytes) -> None:
+    writer.write(data)
+    try:
+        await asyncio.wait_for(writer.drain(), SSE_STALL_TIMEOUT)
+    except asyncio.TimeoutError:
+        # Socket open but not reading (e.g. a backgrounded tab): the
+        # transport buffer would grow without bound
+        _stats["clients_stalled"] += 1
+        raise
+
+
+async def _serve_sse(req: _Request, writer: asyncio.StreamWriter) -> None:
+    device = req.arg("device")
+    coalesce = req.arg("coalesce")
+    coalesce = SSE_COALESCE if coalesce is None else coalesce not in ("0", "false")
+    delta = req.arg("delta") in ("1", "true")
+    writer.write(_head(HTTPStatus.OK, {
+        "Content-Type": "text/event-stream",
+        "Cache-Control": "no-cache",
+        "Connection": "keep-alive",
+        "Access-Control-Allow-Origin": "*",
+    }))
+    sub = _Subscriber(device, coalesce, delta)
+    if device is None:
+        current = [d.frame for d in _devices.values() if d.frame]
+    else:
+        dev = _devices.get(device)
+        current = [dev.frame] if dev and dev.frame else []
+    # Every (re)connect starts from a full keyframe per board, nothing is
+    # replayed. Last-Event-ID is not trusted: it is one id across all
+    # boards, and the frames just before it may have been coalesced or
+    # dropped on the old connection, so the client may lack that base.
+    keyframes = [sub.encode(frame) for frame in current]
+    # Registered before the first await so no sample slips in between
+    _clients.setdefault(device, []).append(sub)
+    _stats["clients_total"] += 1
+    try:
+        await _sse_send(writer, b"".join(keyframes))
+        while True:
+            frames = await sub.drain(SSE_HEARTBEAT)
+            # One write for everything that queued up while we were draining
+            await _sse_send(writer, b"".join(frames) if frames else SSE_HEARTBEAT_FRAME)
+    finally:
+        topic = _clients.get(device, [])
+        if sub in topic:
+            topic.remove(sub)
+        if not topic:
+            _clients.pop(device, None)
+
+
+async def _serve_echo(req: _Request, writer: asyncio.StreamWriter) -> None:
+    """A dashboard painted the frame with this id (its Last-Event-ID)."""
+    try:
+        sent = _sent_at.get(int(req.arg("id") or ""))
+    except ValueError:
+        raise _HTTPError(HTTPStatus.BAD_REQUEST, "id must be an event id")
+    if sent is not None:
+        _record_latency("send_echo", (time.perf_counter() - sent) * 1000)
+    writer.write(_head(HTTPStatus.NO_CONTENT, {
+        "Access-Control-Allow-Origin": "*",
+        "Connection": "close",
+    }))
+    await writer.drain()
+
+
+# ── Prometheus exposition ─────────────────────────────────────────────────────
+
+PROM_PREFIX = "xg27_"
+PROM_CONTENT_TYPE = "text/plain; version=0.0.4; charset=utf-8"
+# Sample key, metric name, help, flag bit that says the value is valid
+PROM_SENSORS = (
+    ("t", "temperature_celsius",       "Temperature",         payload.FLAG_TEMP),
+    ("h", "humidity_percent",          "Relative humidity",   payload.FLAG_TEMP),
+    ("l", "illuminance_lux",           "Ambient light",       payload.FLAG_LUX),
+    ("m", "magnetic_field_microtesla", "Magnetic field (Z)",  payload.FLAG_MAG),
+)
+# _stats key, counter name, help
+PROM_COUNTERS = (
+    ("adv_received",     "adv_received_total",         "Advertisements reported by the scanner"),
+    ("adv_duplicates",   "adv_duplicates_total",       "Advertisements dropped as repeats of the last payload"),
+    ("scan_restarts",    "scan_restarts_total",        "BLE scanner restarts after an error or silence"),
+    ("clients_total",    "sse_connections_total",      "SSE connections accepted"),
+    ("clients_stalled",  "sse_stalled_total",          "SSE clients dropped for not reading"),
+    ("frames_sent",      "sse_frames_sent_total",      "SSE frames written to clients"),
+    ("frames_dropped",   "sse_frames_dropped_total",   "SSE frames dropped from full client queues"),
+    ("frames_coalesced", "sse_frames_coalesced_total", "SSE frames replaced by a newer one of the same board"),
+    ("lag_events",       "sse_lag_events_total",       "Times an SSE client started losing frames"),
+)
+
+
+def _prom_escape(value: str) -> str:
+    return value.replace("\\", "\\\\").replace('"', '\\"').replace("\n", "\\n")
+
+
+class _Exposition:
+    """Prometheus text format, built one metric family at a time."""
+
+    def __init__(self) -> None:
+        self.lines: list[str] = []
+
+    def family(self, name: str, kind: str, help_text: str) -> None:
+        self.lines.append(f"# HELP {PROM_PREFIX}{name} {help_text}")
+        self.lines.append(f"# TYPE {PROM_PREFIX}{name} {kind}")
+
+    def sample(self, name: str, value: float, **labels: Any) -> None:
+        lbl = ",".join(f'{k}="{_prom_escape(str(v))}"' for k, v in labels.items())
+        self.lines.append(f"{PROM_PREFIX}{name}{{{lbl}}} {value}" if lbl
+                          else f"{PROM_PREFIX}{name} {value}")
+
+    def body(self) -> bytes:
+        return ("\n".join(self.lines) + "\n").encode()
+
+
+def _exposition() -> bytes:
+    out = _Exposition()
+    out.family("start_time_seconds", "gauge", "Unix time the bridge started")
+    out.sample("start_time_seconds", round(_started, 3))
+    out.family("devices", "gauge", "Boards heard since start")
+    out.sample("devices", len(_devices))
+
+    for key, name, help_text, bit in PROM_SENSORS:
+        out.family(name, "gauge", help_text + " of the latest sample")
+        for a, d in _devices.items():
+            if d.latest.get("f", 0) & bit:
+                out.sample(name, d.latest[key], device=a)
+    out.family("rssi_dbm", "gauge", "Signal strength of the last advertisement")
+    for a, d in _devices.items():
+        if d.rssi is not None:
+            out.sample("rssi_dbm", d.rssi, device=a)
+    out.family("last_seen_timestamp_seconds", "gauge", "Unix time of the last advertisement")
+    for a, d in _devices.items():
+        out.sample("last_seen_timestamp_seconds", round(d.last_seen, 3), device=a)
+    out.family("samples_received_total", "counter", "Sequenced samples received")
+    out.family("samples_lost_total", "counter", "Samples missing from sequence gaps")
+    for a, d in _devices.items():
+        if d.received or d.lost:
+            out.sample("samples_received_total", d.received, device=a)
+            out.sample("samples_lost_total", d.lost, device=a)
+
+    for key, name, help_text in PROM_COUNTERS:
+        out.family(name, "counter", help_text)
+        out.sample(name, _stats[key])
+
+    subs = [sub for topic in _clients.values() for sub in topic]
+    out.family("sse_clients", "gauge", "Connected SSE clients")
+    out.sample("sse_clients", len(subs))
+    out.family("sse_clients_lagging", "gauge", "SSE clients that lost frames since their last write")
+    out.sample("sse_clients_lagging", sum(sub.lagging for sub in subs))
+    out.family("sse_queue_frames", "gauge", "SSE frames waiting, all clients")
+    out.sample("sse_queue_frames", sum(sub.pending for sub in subs))
+    out.family("sse_queue_frames_max", "gauge", "SSE frames waiting, longest client queue")
+    out.sample("sse_queue_frames_max", max((sub.pending for sub in subs), default=0))
+    out.family("store_pending_samples", "gauge", "Samples waiting for the next history write")
+    out.sample("store_pending_samples", _store.pending)
+    out.family("sink_connected", "gauge", "Whether the sink's destination is reachable")
+    for sink in _sinks:
+        out.sample("sink_connected", int(sink.connected()), sink=sink.kind)
+    out.family("sink_messages_total", "counter", "Sink messages by outcome")
+    for sink in _sinks:
+        st = sink.stats()
+        for result in ("sent", "spooled", "dropped"):
+            out.sample("sink_messages_total", st[result], sink=sink.kind, result=result)
+
+    out.family("callback_duration_seconds", "histogram", "Handling time per callback")
+    for name, hist in _callback_time.items():
+        total = 0
+        for le, n in zip(CALLBACK_BUCKETS, hist.counts):
+            total += n
+            out.sample("callback_duration_seconds_bucket", total, callback=name, le=le)
+        out.sample("callback_duration_seconds_bucket", hist.count, callback=name, le="+Inf")
+        out.sample("callback_duration_seconds_sum", round(hist.sum, 6), callback=name)
+        out.sample("callback_duration_seconds_count", hist.count, callback=name)
+
+    out.family("latency_seconds", "summary",
+               f"Sample to dashboard latency per stage; quantiles over the last {LATENCY_WINDOW}")
+    for stage, values in _latency.items():
+        for q, v in _percentiles(values).items():
+            if q.startswith("p"):
+                out.sample("latency_seconds", round(v / 1000, 6), stage=stage,
+                           quantile=int(q[1:]) / 100)
+        n, total_ms = _latency_total[stage]
+        out.sample("latency_seconds_sum", round(total_ms / 1000, 6), stage=stage)
+        out.sample("latency_seconds_count", n, stage=stage)
+    return out.body()
+
+
+async def _serve_metrics(req: _Request, writer: asyncio.StreamWriter) -> None:
+    if req.arg("format") == "json":
+        await _send_json(writer, {
+            "window": LATENCY_WINDOW,
+            "latency_ms": {stage: _percentiles(v) for stage, v in _latency.items()},
+            "loss": {a: d.loss() for a, d in _devices.items() if d.received or d.lost},
+        })
+        return
+    await _respond(writer, _exposition(), PROM_CONTENT_TYPE)
+
+
+async def _serve_stats(req: _Request, writer: asyncio.StreamWriter) -> None:
+    subs = [sub for topic in _clients.values() for sub in topic]
+    await _send_json(writer, {
+        "uptime_s": round(time.time() - _started, 1),
+        "devices": len(_devices),
+        "clients": len(subs),
+        "lagging": sum(sub.lagging for sub in subs),
+        "pending": sum(sub.pending for sub in subs),
+        **{k: _stats[k] for k in STATS_COUNTERS},
+        "sinks": {sink.kind: sink.stats() for sink in _sinks},
+        "subscribers": [sub.stats() for sub in subs],
+    })
+
+
+_ROUTES = {
+    "/":            _serve_html,
+    "/sensor.html": _serve_html,
+    "/events":      _serve_sse,
+    "/devices":     _serve_devices,
+    "/history":     _serve_history,
+    "/history.bin": _serve_history_bin,
+    "/stats":       _serve_stats,
+    "/metrics":     _serve_metrics,
+    "/echo":        _serve_echo,
+}
+
+
+async def _handle_conn(reader: asyncio.StreamReader, writer: asyncio.StreamWriter) -> None:
+    try:
+        try:
+            req = await _read_request(reader)
+            if req is None:
+                return
+            if req.method != "GET":
+                raise _HTTPError(HTTPStatus.METHOD_NOT_ALLOWED)
+            handler = _ROUTES.get(req.path)
+            if handler is None:
+                raise _HTTPError(HTTPStatus.NOT_FOUND)
+            await handler(req, writer)
+        except _HTTPError as err:
+            await _respond(writer, err.message.encode(), "text/plain; charset=utf-8",
+                           err.status)
+    except (ConnectionError, asyncio.TimeoutError, asyncio.IncompleteReadError,
+            asyncio.LimitOverrunError):
+        pass  # client went away or stalled; nothing to answer
+    finally:
+        writer.close()
 
 
 # ── Entry point ───────────────────────────────────────────────────────────────
 
-async def main() -> None:
-    ip = _wifi_ip()
-    log.info("Dashboard (Mac):    http://localhost:%d/", PORT)
-    log.info("Dashboard (iPhone): http://%s:%d/", ip, PORT)
+def _host_port(value: str, default_port: int | None = None) -> tuple[str, int]:
+    host, sep, port = value.rpartition(":")
+    if not sep:
+        if default_port is None:
+            raise argparse.ArgumentTypeError(f"{value!r}: HOST:PORT expected")
+        return value, default_port
+    if not port.isdigit():
+        raise argparse.ArgumentTypeError(f"{value!r}: bad port")
+    return host, int(port)
+
+
+def _parse_args() -> argparse.Namespace:
+    ap = argparse.ArgumentParser(description="xG27 sensor bridge")
+    ap.add_argument("--headless", action="store_true",
+                    help="no dashboard, HTTP server or history store; forward to the sinks only")
+    ap.add_argument("--mqtt", metavar="HOST[:PORT]", type=lambda v: _host_port(v, 1883),
+                    help="publish samples to this MQTT broker (needs paho-mqtt)")
+    ap.add_argument("--udp", metavar="HOST:PORT", type=_host_port,
+                    help="send samples as InfluxDB line protocol datagrams")
+    ap.add_argument("--scanner", choices=("auto", "hci", "bleak"), default=SCAN_BACKEND,
+                    help="BLE backend: raw HCI socket (Linux) or bleak (default: %(default)s)")
+    ap.add_argument("--port", type=int, default=PORT,
+                    help="HTTP port of the dashboard (default: %(default)s)")
+    ap.add_argument("--db", metavar="PATH", type=pathlib.Path, default=DB_FILE,
+                    help="SQLite history store (default: %(default)s)")
+    args = ap.parse_args()
+    if args.headless and not (args.mqtt or args.udp):
+        ap.error("--headless needs --mqtt or --udp")
+    return args
+
+
+async def main(args: argparse.Namespace) -> None:
+    global _headless, _store
+    _store = store.Store(args.db)
+    if args.mqtt:
+        _sinks.append(sinks.MQTTSink(*args.mqtt, SPOOL_DIR / "mqtt.jsonl"))
+    if args.udp:
+        _sinks.append(sinks.UDPSink(*args.udp, SPOOL_DIR / "udp.jsonl"))
+    tasks = [ble_loop(args.scanner), *(sink.run() for sink in _sinks)]
+    if args.headless:
+        _headless = True
+        log.info("Headless: forwarding to %s", ", ".join(sink.kind for sink in _sinks))
+        await asyncio.gather(*tasks)
+        return
+
+    log.info("Dashboard (this machine): http://localhost:%d/", args.port)
+    log.info("Dashboard (LAN):          http://%s:%d/", _lan_ip(), args.port)
 
-    threading.Thread(target=lambda: _Server(("", PORT), _Handler).serve_forever(),
-                     daemon=True).start()
-    await ble_loop()
+    server = await asyncio.start_server(_handle_conn, port=args.port, reuse_address=True)
+    async with server:
+        await asyncio.gather(server.serve_forever(), _store.run(STORE_FLUSH), *tasks)
 
 
 if __name__ == "__main__":
-    asyncio.run(main())
+    asyncio.run(main(_parse_args()))
@@ -0,0 +1,348 @@
+#!/usr/bin/env python3
+"""
+Load generator for the bridge: synthetic boards and a swarm of SSE clients.
+
+Runs the sensor_server HTTP/SSE side in this process and feeds its
+_on_adv() callback with timed advertisements (type 0x03) from --devices
+simulated boards, each with its own address and sequence counter, in place
+of the BLE scanner. Every payload goes through the same dedup, decode,
+store, broadcast and sink path as a real one:
+
+    python3 host/simulator.py --devices 100 --rate 10 --clients 500
+
+--dups repeats each advertisement the way OS scanners report it several
+times, --loss skips sequence numbers. --clients opens that many /events
+connections against the in-process bridge; with --attach HOST:PORT only the
+swarm runs, against a bridge in another process, so the two do not share
+an event loop:
+
+    python3 host/simulator.py --devices 100 --clients 0 --port 5557 --seconds 120 &
+    python3 host/simulator.py --attach localhost:5557 --clients 500
+
+The history store goes to a temporary database. At the end a summary
+(generated and handled rates, CPU per advertisement, on_adv and broadcast
+time, event loop lag, SSE frames and drops, receive → client latency) is
+printed and, with --json, written as one object.
+"""
+
+import argparse
+import asyncio
+import json
+import logging
+import pathlib
+import random
+import tempfile
+import time
+from typing import Any
+
+import hci
+import payload
+import sensor_server as server
+import store
+
+log = logging.getLogger("simulator")
+
+SIM_DEVICES   = 100
+SIM_RATE      = 1.0    # advertisements per second and board
+SIM_CLIENTS   = 500
+SIM_SECONDS   = 30
+SIM_WARMUP    = 2      # seconds of load before measuring
+LAG_INTERVAL  = 0.05   # seconds between event loop lag probes
+CLIENT_SPREAD = 1.0    # seconds over which the swarm connects
+LATENCY_EVERY = 10     # clients decode every Nth frame, so the swarm stays cheap
+
+
+def _address(i: int) -> str:
+    """Locally administered, so it cannot clash with a real board."""
+    return f"02:00:00:00:{i >> 8 & 0xFF:02X}:{i & 0xFF:02X}"
+
+
+# ── Synthetic boards ──────────────────────────────────────────────────────────
+
+class _Board:
+    """One simulated board: random-walk readings, seq and uptime."""
+
+    __slots__ = ("device", "seq", "up", "temp", "lux", "mag")
+
+    def __init__(self, i: int) -> None:
+        self.device = hci.Device(_address(i), server.DEVICE_NAME)
+        self.seq = random.randrange(0x10000)
+        self.up = random.randrange(1 << 24)
+        self.temp = random.randint(1800, 2600)
+        self.lux = random.randint(0, 2000)
+        self.mag = random.randint(-200, 200)
+
+    def advertisement(self, period_ms: int, skip: int) -> hci.Advertisement:
+        self.seq = (self.seq + 1 + skip) & 0xFFFF
+        self.up += period_ms * (1 + skip)
+        self.temp += random.randint(-3, 3)
+        self.lux = max(0, min(0xFFFF, self.lux + random.randint(-20, 20)))
+        self.mag = max(-0x8000, min(0x7FFF, self.mag + random.randint(-5, 5)))
+        raw = (payload.TIMED_HDR.pack(payload.TYPE_TIMED, self.seq, self.up & 0xFFFFFFFF) +
+               payload.SAMPLE.pack(self.temp, 45, self.lux, self.mag,
+                                   payload.FLAG_TEMP | payload.FLAG_LUX | payload.FLAG_MAG))
+        return hci.Advertisement({server.COMPANY_ID: raw}, random.randint(-90, -40))
+
+
+async def _run_board(board: _Board, rate: float, dups: int, loss: float,
+                     generated: list[int]) -> None:
+    loop = asyncio.get_running_loop()
+    period = 1 / rate
+    period_ms = round(period * 1000)
+    # Spread the boards over one period instead of firing them together
+    due = loop.time() + random.uniform(0, period)
+    while True:
+        await asyncio.sleep(max(0.0, due - loop.time()))
+        due += period
+        skip = 0
+        while loss and random.random() < loss:
+            skip += 1
+        adv = board.advertisement(period_ms, skip)
+        for _ in range(1 + dups):
+            server._on_adv(board.device, adv)
+        generated[0] += 1 + dups
+
+
+async def _measure_lag(lags: list[float]) -> None:
+    """How late the event loop wakes a sleeper, in ms."""
+    loop = asyncio.get_running_loop()
+    while True:
+        t0 = loop.time()
+        await asyncio.sleep(LAG_INTERVAL)
+        lags.append((loop.time() - t0 - LAG_INTERVAL) * 1000)
+
+
+# ── SSE swarm ─────────────────────────────────────────────────────────────────
+
+class _Client:
+    __slots__ = ("frames", "latency", "connected", "error")
+
+    def __init__(self) -> None:
+        self.frames = 0
+        self.latency: list[float] = []
+        self.connected = False
+        self.error: str | None = None
+
+
+async def _run_client(host: str, port: int, query: str, client: _Client,
+                      delay: float) -> None:
+    await asyncio.sleep(delay)
+    try:
+        reader, writer = await asyncio.open_connection(host, port)
+    except OSError as exc:
+        client.error = str(exc)
+        return
+    try:
+        target = "/events" + (f"?{query}" if query else "")
+        writer.write(f"GET {target} HTTP/1.1\r\nHost: {host}\r\n\r\n".encode())
+        while await reader.readline() not in (b"\r\n", b""):
+            pass
+        client.connected = True
+        while line := await reader.readline():
+            if not line.startswith(b"data: "):
+                continue
+            client.frames += 1
+            if client.frames % LATENCY_EVERY == 0:
+                now = time.time()
+                ts = json.loads(line[6:]).get("ts")
+                if ts is not None:
+                    client.latency.append((now - ts) * 1000)
+        client.error = "closed by the bridge"
+    except (OSError, ValueError) as exc:
+        client.error = str(exc)
+    finally:
+        writer.close()
+
+
+def _reset(clients: list[_Client]) -> None:
+    for c in clients:
+        c.frames = 0
+        c.latency.clear()
+
+
+def _swarm_report(clients: list[_Client]) -> dict[str, Any]:
+    frames = [c.frames for c in clients]
+    return {
+        "clients": len(clients),
+        "connected": sum(c.connected for c in clients),
+        "failed": sum(c.error is not None for c in clients),
+        "frames": sum(frames),
+        "frames_per_client": {"min": min(frames, default=0), "max": max(frames, default=0)},
+        "latency_ms": server._percentiles([v for c in clients for v in c.latency]),
+    }
+
+
+# ── Entry point ───────────────────────────────────────────────────────────────
+
+def _raise_fd_limit() -> None:
+    """Each client costs two descriptors when the bridge runs in-process."""
+    try:
+        import resource
+    except ImportError:
+        return
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft != hard:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+
+
+def _parse_args() -> argparse.Namespace:
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    ap.add_argument("--devices", type=int, default=SIM_DEVICES,
+                    help="simulated boards (default: %(default)s)")
+    ap.add_argument("--rate", type=float, default=SIM_RATE,
+                    help="advertisements per second per board (default: %(default)s)")
+    ap.add_argument("--dups", type=int, default=0,
+                    help="extra reports of each advertisement (default: %(default)s)")
+    ap.add_argument("--loss", type=float, default=0.0,
+                    help="probability of skipping a sequence number (default: %(default)s)")
+    ap.add_argument("--clients", type=int, default=SIM_CLIENTS,
+                    help="SSE connections to /events (default: %(default)s)")
+    ap.add_argument("--query", default="",
+                    help="query string for the clients, e.g. delta=1 or coalesce=1")
+    ap.add_argument("--seconds", type=float, default=SIM_SECONDS,
+                    help="measurement length (default: %(default)s)")
+    ap.add_argument("--port", type=int, default=0,
+                    help="HTTP port of the in-process bridge (default: any free port)")
+    ap.add_argument("--attach", metavar="HOST:PORT", type=server._host_port,
+                    help="run only the swarm, against this bridge")
+    ap.add_argument("--json", metavar="PATH", type=pathlib.Path,
+                    help="write the results here as JSON")
+    args = ap.parse_args()
+    if args.rate <= 0:
+        ap.error("--rate must be positive")
+    if not 0 <= args.loss < 1:
+        ap.error("--loss must be in [0, 1)")
+    return args
+
+
+def _quiet_cancel(loop: asyncio.AbstractEventLoop, context: dict[str, Any]) -> None:
+    # Before Python 3.12 asyncio logs every start_server handler that is
+    # still running at shutdown, i.e. each open SSE connection, as an error
+    if not isinstance(context.get("exception"), asyncio.CancelledError):
+        loop.default_exception_handler(context)
+
+
+async def _simulate(args: argparse.Namespace) -> dict[str, Any]:
+    asyncio.get_running_loop().set_exception_handler(_quiet_cancel)
+    tasks: list[asyncio.Task] = []
+    lags: list[float] = []
+    generated = [0]
+    server_obj = None
+    tmp = None
+    if args.attach:
+        host, port = args.attach
+    else:
+        tmp = tempfile.TemporaryDirectory(prefix="xg27-sim-")
+        server._store = store.Store(pathlib.Path(tmp.name) / "history.db")
+        server_obj = await asyncio.start_server(server._handle_conn, "127.0.0.1", args.port,
+                                                reuse_address=True)
+        host, port = "127.0.0.1", server_obj.sockets[0].getsockname()[1]
+        log.info("Bridge on http://%s:%d/ fed by %d boards at %g Hz (%d dup, %.1f %% loss)",
+                 host, port, args.devices, args.rate, args.dups, args.loss * 100)
+        tasks += [asyncio.create_task(server_obj.serve_forever()),
+                  asyncio.create_task(server._store.run(server.STORE_FLUSH)),
+                  *(asyncio.create_task(sink.run()) for sink in server._sinks)]
+        tasks += [asyncio.create_task(_run_board(_Board(i), args.rate, args.dups, args.loss,
+                                                 generated))
+                  for i in range(args.devices)]
+    tasks.append(asyncio.create_task(_measure_lag(lags)))
+
+    clients = [_Client() for _ in range(args.clients)]
+    tasks += [asyncio.create_task(_run_client(host, port, args.query, c,
+                                              i * CLIENT_SPREAD / max(1, args.clients)))
+              for i, c in enumerate(clients)]
+    if clients:
+        log.info("Connecting %d SSE client(s) to %s:%d", len(clients), host, port)
+    await asyncio.sleep(CLIENT_SPREAD + SIM_WARMUP)
+
+    # Measure from here on
+    _reset(clients)
+    lags.clear()
+    gen0 = generated[0]
+    stats0 = dict(server._stats)
+    hist0 = {k: (h.count, h.sum) for k, h in server._callback_time.items()}
+    for v in server._latency.values():
+        v.clear()
+    cpu0 = time.process_time()
+    t0 = time.perf_counter()
+    await asyncio.sleep(args.seconds)
+    elapsed = time.perf_counter() - t0
+    cpu = time.process_time() - cpu0
+    swarm = _swarm_report(clients)
+
+    for task in tasks:
+        task.cancel()
+    await asyncio.gather(*tasks, return_exceptions=True)
+    if server_obj is not None:
+        server_obj.close()
+    if tmp is not None:
+        tmp.cleanup()
+
+    results: dict[str, Any] = {
+        "seconds": round(elapsed, 2),
+        "cpu_percent": round(cpu / elapsed * 100, 1),
+        "loop_lag_ms": server._percentiles(lags),
+        "swarm": swarm,
+    }
+    if args.attach:
+        results["attach"] = f"{host}:{port}"
+        return results
+
+    delta = {k: server._stats[k] - stats0.get(k, 0) for k in server.STATS_COUNTERS}
+    adv = generated[0] - gen0
+    handled = {}
+    for name, h in server._callback_time.items():
+        n0, s0 = hist0.get(name, (0, 0.0))
+        n = h.count - n0
+        handled[name] = {"calls": n, "mean_us": round((h.sum - s0) / n * 1e6, 2) if n else None}
+    lost = sum(d.lost for d in server._devices.values())
+    received = sum(d.received for d in server._devices.values())
+    results.update({
+        "devices": args.devices,
+        "rate_hz": args.rate,
+        "dups": args.dups,
+        "loss": args.loss,
+        "adv_per_s": round(adv / elapsed, 1),
+        # Includes the swarm when it runs in this process
+        "cpu_us_per_adv": round(cpu / adv * 1e6, 2) if adv else None,
+        "counters": delta,
+        "callbacks": handled,
+        "bridge_latency_ms": {k: server._percentiles(v) for k, v in server._latency.items()},
+        "seq_loss_rate": round(lost / (received + lost), 4) if received + lost else 0.0,
+    })
+    return results
+
+
+def _print(results: dict[str, Any]) -> None:
+    print()
+    if "adv_per_s" in results:
+        c = results["counters"]
+        print(f"  generated   {results['adv_per_s']} adv/s from {results['devices']} boards,"
+              f" {c['adv_duplicates']} duplicates dropped,"
+              f" seq loss {results['seq_loss_rate']}")
+        for name, h in results["callbacks"].items():
+            print(f"  {name:<11} {h['calls']} calls, mean {h['mean_us']} µs")
+        print(f"  cpu         {results['cpu_percent']} %, {results['cpu_us_per_adv']} µs/adv")
+        print(f"  sse         {c['frames_sent']} frames sent, {c['frames_dropped']} dropped,"
+              f" {c['frames_coalesced']} coalesced, {c['clients_stalled']} stalled")
+    else:
+        print(f"  cpu         {results['cpu_percent']} % (swarm only)")
+    print(f"  loop lag    {results['loop_lag_ms']}")
+    s = results["swarm"]
+    if s["clients"]:
+        print(f"  clients     {s['connected']}/{s['clients']} connected, {s['failed']} failed,"
+              f" {s['frames_per_client']['min']}–{s['frames_per_client']['max']} frames each")
+        print(f"  latency     {s['latency_ms']}")
+
+
+def main() -> None:
+    args = _parse_args()
+    _raise_fd_limit()
+    results = asyncio.run(_simulate(args))
+    _print(results)
+    if args.json is not None:
+        args.json.write_text(json.dumps(results, indent=2) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,303 @@
+"""
+Output stages that forward decoded samples off the bridge.
+
+A sink collects samples from the BLE callback and delivers them in
+batches: once SINK_BATCH samples are waiting, or SINK_INTERVAL seconds
+after the first one, whichever comes first. Messages that cannot be
+delivered are appended to a spool file and replayed, oldest first, before
+anything newer once the destination takes data again.
+
+    MQTTSink  one JSON array per board and batch on <prefix>/<address>/samples
+              (paho-mqtt, optional dependency)
+    UDPSink   InfluxDB line protocol, packed into datagrams
+"""
+
+import asyncio
+import json
+import logging
+import pathlib
+import socket
+from typing import Any
+
+try:
+    import paho.mqtt.client as mqtt  # optional; only the MQTT sink needs it
+except ImportError:
+    mqtt = None
+
+import payload
+
+log = logging.getLogger(__name__)
+
+SINK_BATCH       = 50        # samples per delivery at most
+SINK_INTERVAL    = 1.0       # seconds a sample may wait for its batch to fill
+SPOOL_MAX        = 16 << 20  # bytes; further messages are dropped until it is replayed
+MQTT_PREFIX      = "xg27"
+MQTT_KEEPALIVE   = 30
+# Topic kind → QoS. Samples go at QoS 0 and accept loss: a batch the broker
+# drops while the connection is up is gone; only batches that paho refused
+# outright are spooled. The retained bridge status is rare and must arrive.
+MQTT_QOS         = {"samples": 0, "status": 1}
+UDP_MAX_DATAGRAM = 1400      # bytes; stays below a typical path MTU
+UDP_PROBE        = 0.2       # seconds to wait for an error on a fresh socket
+LINE_MEASUREMENT = "xg27"
+
+# Sample key, flag bit that says the value is valid, integer field
+_LINE_FIELDS = (
+    ("t", payload.FLAG_TEMP, False),
+    ("h", payload.FLAG_TEMP, True),
+    ("l", payload.FLAG_LUX,  True),
+    ("m", payload.FLAG_MAG,  False),
+)
+
+# (topic or None, QoS, body)
+Message = tuple[str | None, int, str]
+
+
+class Sink:
+    """Batching, spooling base; subclasses encode and send messages."""
+
+    kind = "sink"
+
+    def __init__(self, spool: pathlib.Path) -> None:
+        self.spool = spool
+        self.sent = 0
+        self.spooled = 0
+        self.dropped = 0
+        self._pending: list[tuple[str, dict[str, Any]]] = []
+        self._wake = asyncio.Event()
+
+    # ── Event loop side ──────────────────────────────────────────────────────
+
+    def add(self, address: str, sample: dict[str, Any]) -> None:
+        self._pending.append((address, sample))
+        # Wake once to start the batch timer, once more when it is full
+        if len(self._pending) in (1, SINK_BATCH):
+            self._wake.set()
+
+    async def run(self) -> None:
+        await self.connect()
+        while True:
+            if not self._pending:
+                self._wake.clear()
+                await self._wake.wait()
+            if len(self._pending) < SINK_BATCH:
+                self._wake.clear()
+                try:
+                    await asyncio.wait_for(self._wake.wait(), SINK_INTERVAL)
+                except asyncio.TimeoutError:
+                    pass
+            batch, self._pending = self._pending, []
+            if not self.connected():
+                await self.connect()
+            if self.connected() and self.spool.exists():
+                await self._replay()
+            for i in range(0, len(batch), SINK_BATCH):
+                self._deliver(self.encode(batch[i:i + SINK_BATCH]))
+
+    def stats(self) -> dict[str, Any]:
+        return {
+            "connected": self.connected(),
+            "sent": self.sent,
+            "spooled": self.spooled,
+            "dropped": self.dropped,
+        }
+
+    # ── Delivery ─────────────────────────────────────────────────────────────
+
+    def _deliver(self, messages: list[Message]) -> None:
+        for i, msg in enumerate(messages):
+            if not (self.connected() and self.send(*msg)):
+                self._spool_write(messages[i:])
+                return
+            self.sent += 1
+
+    def _spool_write(self, messages: list[Message]) -> None:
+        # Small appends, at most one per batch: cheaper inline than a thread
+        size = self.spool.stat().st_size if self.spool.exists() else 0
+        if size >= SPOOL_MAX:
+            self.dropped += len(messages)
+            return
+        self.spool.parent.mkdir(parents=True, exist_ok=True)
+        with self.spool.open("a", encoding="utf-8") as f:
+            for msg in messages:
+                f.write(json.dumps(msg) + "\n")
+        if not self.spooled:
+            log.warning("%s sink: destination unreachable, spooling to %s", self.kind, self.spool)
+        self.spooled += len(messages)
+
+    async def _replay(self) -> None:
+        # Up to SPOOL_MAX: file I/O off the event loop, and a turn for the
+        # BLE callbacks and socket errors after every SINK_BATCH messages
+        text = await asyncio.to_thread(self.spool.read_text, encoding="utf-8")
+        lines = text.splitlines()
+        for i, line in enumerate(lines):
+            if i and i % SINK_BATCH == 0:
+                await asyncio.sleep(0)
+            if not (self.connected() and self.send(*json.loads(line))):
+                rest = "\n".join(lines[i:]) + "\n"
+                await asyncio.to_thread(self.spool.write_text, rest, encoding="utf-8")
+                return
+            self.sent += 1
+        self.spool.unlink()
+        log.info("%s sink: replayed %d spooled message(s)", self.kind, len(lines))
+
+    # ── Subclass interface ───────────────────────────────────────────────────
+
+    async def connect(self) -> None:
+        """(Re)open the destination; must not raise."""
+
+    def connected(self) -> bool:
+        raise NotImplementedError
+
+    def encode(self, batch: list[tuple[str, dict[str, Any]]]) -> list[Message]:
+        raise NotImplementedError
+
+    def send(self, topic: str | None, qos: int, body: str) -> bool:
+        """Hand one message to the transport; False if it was not taken."""
+        raise NotImplementedError
+
+
+class MQTTSink(Sink):
+    """Publishes through paho's network thread, which also reconnects.
+
+    The bridge status topic is retained: "online" on every connect, and
+    "offline" as the will when the bridge drops off the broker.
+    """
+
+    kind = "mqtt"
+
+    def __init__(self, host: str, port: int, spool: pathlib.Path) -> None:
+        if mqtt is None:
+            raise RuntimeError("the MQTT sink needs paho-mqtt (pip install paho-mqtt)")
+        super().__init__(spool)
+        self.host = host
+        self.port = port
+        # paho 2 wants the callback API version; 1.x has no such argument
+        if hasattr(mqtt, "CallbackAPIVersion"):
+            self._client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+        else:
+            self._client = mqtt.Client()
+        self._client.on_connect = self._on_connect
+        self._client.on_disconnect = self._on_disconnect
+        self._status = f"{MQTT_PREFIX}/bridge/{socket.gethostname()}/status"
+        self._client.will_set(self._status, "offline", MQTT_QOS["status"], retain=True)
+        self._started = False
+        self._connected = False  # written on paho's thread; a plain bool swap
+
+    async def connect(self) -> None:
+        if self._started:
+            return  # paho retries on its own
+        self._client.connect_async(self.host, self.port, MQTT_KEEPALIVE)
+        self._client.loop_start()
+        self._started = True
+
+    def connected(self) -> bool:
+        return self._connected
+
+    def _on_connect(self, client, userdata, flags, reason, *_) -> None:
+        if reason == 0:
+            self._connected = True
+            client.publish(self._status, "online", MQTT_QOS["status"], retain=True)
+            log.info("mqtt sink: connected to %s:%d", self.host, self.port)
+
+    def _on_disconnect(self, client, userdata, *_) -> None:
+        self._connected = False
+
+    def encode(self, batch: list[tuple[str, dict[str, Any]]]) -> list[Message]:
+        by_board: dict[str, list[dict[str, Any]]] = {}
+        for address, sample in batch:
+            by_board.setdefault(address, []).append(sample)
+        return [(f"{MQTT_PREFIX}/{address}/samples", MQTT_QOS["samples"],
+                 json.dumps(samples, separators=(",", ":")))
+                for address, samples in by_board.items()]
+
+    def send(self, topic: str | None, qos: int, body: str) -> bool:
+        return self._client.publish(topic, body, qos).rc == mqtt.MQTT_ERR_SUCCESS
+
+
+def _line_tag(value: str) -> str:
+    return value.replace(",", "\\,").replace("=", "\\=").replace(" ", "\\ ")
+
+
+def line_protocol(address: str, sample: dict[str, Any]) -> str:
+    """One InfluxDB line: valid channels as fields, nanosecond timestamp."""
+    f = sample["f"]
+    fields = [f"{key}={sample[key]}i" if integer else f"{key}={float(sample[key])}"
+              for key, bit, integer in _LINE_FIELDS if f & bit]
+    fields.append(f"f={f}i")
+    ns = round(sample["ts"] * 1000) * 1_000_000
+    return f"{LINE_MEASUREMENT},device={_line_tag(address)} {','.join(fields)} {ns}"
+
+
+class _Datagrams(asyncio.DatagramProtocol):
+    """Keeps the socket error that sendto() reports here instead of raising."""
+
+    def __init__(self) -> None:
+        self.error: OSError | None = None
+
+    def error_received(self, exc: OSError) -> None:
+        self.error = exc
+
+
+class UDPSink(Sink):
+    """Fire-and-forget datagrams, e.g. to a Telegraf socket_listener.
+
+    UDP cannot tell whether the collector took the data. Local failures
+    (no route, name resolution) and the port unreachable a collector host
+    sends back while the collector is down mark the sink disconnected, and
+    later messages spool. Each reconnect first sends a blank line and waits
+    UDP_PROBE for such an error, so the spool is not replayed into a
+    collector that is still down. Datagrams sent before the error came back
+    are lost, and a collector host that is down entirely goes unnoticed.
+    """
+
+    kind = "udp"
+
+    def __init__(self, host: str, port: int, spool: pathlib.Path) -> None:
+        super().__init__(spool)
+        self.host = host
+        self.port = port
+        self._transport: asyncio.DatagramTransport | None = None
+        self._protocol: _Datagrams | None = None
+
+    async def connect(self) -> None:
+        if self._transport is not None:
+            self._transport.close()
+        try:
+            self._transport, self._protocol = \
+                await asyncio.get_running_loop().create_datagram_endpoint(
+                    _Datagrams, remote_addr=(self.host, self.port))
+        except OSError as exc:
+            log.debug("udp sink: %s", exc)
+            self._transport = self._protocol = None
+            return
+        # A blank line: valid line protocol that adds nothing. asyncio
+        # does not send empty datagrams at all
+        self._transport.sendto(b"\n")
+        await asyncio.sleep(UDP_PROBE)
+        if self._protocol.error is not None:
+            log.debug("udp sink: %s", self._protocol.error)
+
+    def connected(self) -> bool:
+        return (self._transport is not None and not self._transport.is_closing()
+                and self._protocol.error is None)
+
+    def encode(self, batch: list[tuple[str, dict[str, Any]]]) -> list[Message]:
+        messages: list[Message] = []
+        datagram = ""
+        for address, sample in batch:
+            line = line_protocol(address, sample)
+            if datagram and len(datagram) + 1 + len(line) > UDP_MAX_DATAGRAM:
+                messages.append((None, 0, datagram))
+                datagram = ""
+            datagram = f"{datagram}\n{line}" if datagram else line
+        if datagram:
+            messages.append((None, 0, datagram))
+        return messages
+
+    def send(self, topic: str | None, qos: int, body: str) -> bool:
+        self._transport.sendto(body.encode())
+        if self._protocol.error is not None:
+            log.debug("udp sink: %s", self._protocol.error)
+            return False
+        return True
@@ -0,0 +1,278 @@
+"""
+Sample history on disk for the dashboard server.
+
+SQLite in WAL mode. Samples are buffered in memory and written in one
+transaction per flush; each flush also refreshes the 1 min and 1 h
+min/avg/max rollups of the buckets it touched, so long time ranges are
+answered from a few hundred pre-computed rows instead of the raw table.
+
+All database work runs on one worker thread that owns the connection; the
+event loop only hands it batches and queries.
+"""
+
+import array
+import asyncio
+import concurrent.futures
+import logging
+import pathlib
+import sqlite3
+import struct
+import sys
+import time
+from typing import Any
+
+import payload
+
+log = logging.getLogger(__name__)
+
+RES_RAW    = 0
+RES_MINUTE = 60
+RES_HOUR   = 3600
+RESOLUTIONS = (RES_RAW, RES_MINUTE, RES_HOUR)
+
+RETENTION = {             # seconds kept per level; hourly rollups are kept forever
+    RES_RAW:    7 * 86400,
+    RES_MINUTE: 90 * 86400,
+}
+PRUNE_INTERVAL = 3600     # seconds between retention passes
+MAX_POINTS     = 1500     # the auto resolution stays below this many points
+RATE_GUESS     = 1.0      # samples/s assumed for a board without recent samples
+
+# Channel, SQL type, flag bit that says the value is valid
+CHANNELS = (
+    ("t", "REAL",    payload.FLAG_TEMP),
+    ("h", "INTEGER", payload.FLAG_TEMP),
+    ("l", "INTEGER", payload.FLAG_LUX),
+    ("m", "REAL",    payload.FLAG_MAG),
+)
+_NAMES = [c for c, _, _ in CHANNELS]
+
+_SCHEMA = f"""
+CREATE TABLE IF NOT EXISTS device (
+    id      INTEGER PRIMARY KEY,
+    address TEXT NOT NULL UNIQUE
+);
+CREATE TABLE IF NOT EXISTS raw (
+    dev INTEGER NOT NULL,
+    ts  REAL NOT NULL,
+    {", ".join(f"{c} {sql_type}" for c, sql_type, _ in CHANNELS)},
+    f   INTEGER NOT NULL
+);
+CREATE INDEX IF NOT EXISTS raw_dev_ts ON raw (dev, ts);
+CREATE TABLE IF NOT EXISTS rollup (
+    res    INTEGER NOT NULL,
+    dev    INTEGER NOT NULL,
+    bucket INTEGER NOT NULL,
+    {", ".join(f"{c}_n INTEGER, {c}_min REAL, {c}_avg REAL, {c}_max REAL" for c in _NAMES)},
+    PRIMARY KEY (res, dev, bucket)
+) WITHOUT ROWID;
+"""
+
+_ROLLUP_COLS = ", ".join(f"{c}_n, {c}_min, {c}_avg, {c}_max" for c in _NAMES)
+
+# Minute buckets straight from the raw rows of one device and time range
+_ROLLUP_MINUTE = f"""
+INSERT OR REPLACE INTO rollup (res, dev, bucket, {_ROLLUP_COLS})
+SELECT {RES_MINUTE}, dev, CAST(ts / {RES_MINUTE} AS INTEGER) * {RES_MINUTE} AS b,
+       {", ".join(f"count({c}), min({c}), avg({c}), max({c})" for c in _NAMES)}
+FROM raw WHERE dev = ? AND ts >= ? AND ts < ? GROUP BY b
+"""
+
+# Hour buckets from the minute buckets, weighting each average by its count
+_ROLLUP_HOUR = f"""
+INSERT OR REPLACE INTO rollup (res, dev, bucket, {_ROLLUP_COLS})
+SELECT {RES_HOUR}, dev, bucket / {RES_HOUR} * {RES_HOUR} AS b,
+       {", ".join(f"sum({c}_n), min({c}_min), sum({c}_avg * {c}_n) / sum({c}_n), max({c}_max)"
+                  for c in _NAMES)}
+FROM rollup WHERE res = {RES_MINUTE} AND dev = ? AND bucket >= ? AND bucket < ? GROUP BY b
+"""
+
+
+def auto_resolution(span: float, rate: float = RATE_GUESS) -> int:
+    """Finest level that keeps span seconds at rate samples/s under MAX_POINTS."""
+    if span * rate <= MAX_POINTS:
+        return RES_RAW
+    if span / RES_MINUTE <= MAX_POINTS:
+        return RES_MINUTE
+    return RES_HOUR
+
+
+class Store:
+    def __init__(self, path: pathlib.Path) -> None:
+        self.path = path
+        self._pending: list[tuple[str, dict[str, Any]]] = []
+        self._exec = concurrent.futures.ThreadPoolExecutor(1, thread_name_prefix="store")
+        self._db: sqlite3.Connection | None = None
+        self._dev_ids: dict[str, int] = {}
+        self._last_prune = 0.0
+
+    # ── Event loop side ──────────────────────────────────────────────────────
+
+    @property
+    def pending(self) -> int:
+        """Samples waiting for the next flush."""
+        return len(self._pending)
+
+    def add(self, address: str, sample: dict[str, Any]) -> None:
+        """Queue one sample; written on the next flush."""
+        self._pending.append((address, sample))
+
+    async def flush(self) -> None:
+        if not self._pending:
+            return
+        batch, self._pending = self._pending, []
+        await asyncio.get_running_loop().run_in_executor(self._exec, self._write, batch)
+
+    async def run(self, interval: float) -> None:
+        """Flush every interval seconds; a failed flush drops its batch."""
+        await asyncio.get_running_loop().run_in_executor(self._exec, self._open)
+        log.info("history store: %s", self.path)
+        while True:
+            await asyncio.sleep(interval)
+            try:
+                await self.flush()
+            except sqlite3.Error as exc:
+                log.error("history store: %s", exc)
+
+    async def query(self, address: str, start: float, end: float,
+                    res: int) -> list[dict[str, Any]]:
+        return await asyncio.get_running_loop().run_in_executor(
+            self._exec, self._query, address, start, end, res)
+
+    # ── Worker thread side ───────────────────────────────────────────────────
+
+    def _open(self) -> None:
+        self.path.parent.mkdir(parents=True, exist_ok=True)
+        db = sqlite3.connect(self.path, check_same_thread=False)
+        db.execute("PRAGMA journal_mode=WAL")
+        db.execute("PRAGMA synchronous=NORMAL")  # WAL keeps this crash-safe
+        db.executescript(_SCHEMA)
+        self._dev_ids = dict(db.execute("SELECT address, id FROM device").fetchall())
+        self._db = db
+
+    def _dev_id(self, address: str) -> int:
+        dev = self._dev_ids.get(address)
+        if dev is None:
+            cur = self._db.execute("INSERT INTO device (address) VALUES (?)", (address,))
+            dev = self._dev_ids[address] = cur.lastrowid
+        return dev
+
+    def _write(self, batch: list[tuple[str, dict[str, Any]]]) -> None:
+        rows = []
+        spans: dict[int, list[float]] = {}
+        with self._db:
+            for address, s in batch:
+                dev = self._dev_id(address)
+                f = s["f"]
+                rows.append((dev, s["ts"], *(s[c] if f & bit else None for c, _, bit in CHANNELS), f))
+                span = spans.setdefault(dev, [s["ts"], s["ts"]])
+                span[0] = min(span[0], s["ts"])
+                span[1] = max(span[1], s["ts"])
+            self._db.executemany(
+                f"INSERT INTO raw (dev, ts, {', '.join(_NAMES)}, f) VALUES (?, ?, ?, ?, ?, ?, ?)",
+                rows)
+            # Recompute only the buckets this batch touched
+            for dev, (lo, hi) in spans.items():
+                m_lo = int(lo) // RES_MINUTE * RES_MINUTE
+                m_hi = int(hi) // RES_MINUTE * RES_MINUTE + RES_MINUTE
+                self._db.execute(_ROLLUP_MINUTE, (dev, m_lo, m_hi))
+                h_lo = m_lo // RES_HOUR * RES_HOUR
+                h_hi = (m_hi - 1) // RES_HOUR * RES_HOUR + RES_HOUR
+                self._db.execute(_ROLLUP_HOUR, (dev, h_lo, h_hi))
+        now = time.time()
+        if now - self._last_prune >= PRUNE_INTERVAL:
+            self._last_prune = now
+            self._prune(now)
+
+    def _prune(self, now: float) -> None:
+        with self._db:
+            self._db.execute("DELETE FROM raw WHERE ts < ?", (now - RETENTION[RES_RAW],))
+            self._db.execute("DELETE FROM rollup WHERE res = ? AND bucket < ?",
+                             (RES_MINUTE, now - RETENTION[RES_MINUTE]))
+
+    def _query(self, address: str, start: float, end: float,
+               res: int) -> list[dict[str, Any]]:
+        dev = self._dev_ids.get(address)
+        if dev is None:
+            return []
+        if res == RES_RAW:
+            cur = self._db.execute(
+                f"SELECT ts, {', '.join(_NAMES)}, f FROM raw"
+                " WHERE dev = ? AND ts >= ? AND ts < ? ORDER BY ts",
+                (dev, start, end))
+            keys = ("ts", *_NAMES, "f")
+            return [dict(zip(keys, row)) for row in cur]
+        cur = self._db.execute(
+            f"SELECT bucket, {_ROLLUP_COLS} FROM rollup"
+            " WHERE res = ? AND dev = ? AND bucket >= ? AND bucket < ? ORDER BY bucket",
+            (res, dev, int(start) // res * res, end))
+        out = []
+        for row in cur:
+            point: dict[str, Any] = {"ts": row[0]}
+            for i, c in enumerate(_NAMES):
+                n, lo, avg, hi = row[1 + 4 * i:5 + 4 * i]
+                # [min, avg, max]; null where the sensor never reported
+                point[c] = [lo, round(avg, 3), hi] if n else None
+            out.append(point)
+        return out
+
+
+# ── Packed binary history ─────────────────────────────────────────────────────
+#
+# Little-endian, laid out so the browser can view each block as a typed
+# array without copying:
+#   [0–3]    "XGH1"
+#   [4]      uint8   channel count C
+#   [5]      uint8   flags (bit0: timestamps are gaps from the previous point)
+#   [6–7]    uint16  timestamp unit (ms)
+#   [8–11]   uint32  point count N
+#   [12–19]  float64 unix time of the first point
+#   [20..]   C channel ids (ASCII), zero-padded to a multiple of 4
+#   then     N × uint32 timestamps (units after the first point)
+#   then     per channel N values: int16 ("t" in centi-°C, "h" %RH, "m" µT)
+#            or uint16 ("l" lux); the type's sentinel marks a missing value
+
+PACK_MAGIC     = b"XGH1"
+PACK_HDR       = struct.Struct("<4sBBHId")
+PACK_DELTA_TS  = 0x01
+# Channel → (array typecode, scale, missing-value sentinel)
+PACK_CHANNELS = {
+    "t": ("h", 100, -0x8000),
+    "h": ("h", 1,   -0x8000),
+    "l": ("H", 1,   0xFFFF),
+    "m": ("h", 1,   -0x8000),
+}
+AGGREGATES = ("min", "avg", "max")
+
+
+def pack(points: list[dict[str, Any]], res: int, channels: list[str],
+         agg: str = "avg", delta: bool = False) -> bytes:
+    """Pack query() output; rollup points contribute their agg value."""
+    tick = 1 if res == RES_RAW else 1000  # raw keeps ms, rollups whole seconds
+    base = points[0]["ts"] if points else 0.0
+    ts = array.array("I", (round((p["ts"] - base) * 1000 / tick) for p in points))
+    if delta:
+        for i in range(len(ts) - 1, 0, -1):
+            ts[i] -= ts[i - 1]
+    pick = AGGREGATES.index(agg)
+    ids = "".join(channels).encode("ascii")
+    blocks = [
+        PACK_HDR.pack(PACK_MAGIC, len(channels), PACK_DELTA_TS if delta else 0,
+                      tick, len(points), base),
+        ids + bytes(-len(ids) % 4),
+        ts,
+    ]
+    for c in channels:
+        code, scale, missing = PACK_CHANNELS[c]
+        lo, hi = (-0x7FFF, 0x7FFF) if code == "h" else (0, 0xFFFE)
+        values = array.array(code)
+        for p in points:
+            v = p.get(c)
+            if v is not None and res != RES_RAW:
+                v = v[pick]
+            values.append(missing if v is None else min(hi, max(lo, round(v * scale))))
+        blocks.append(values)
+    if sys.byteorder != "little":
+        for b in blocks[2:]:
+            b.byteswap()
+    return b"".join(b if isinstance(b, bytes) else b.tobytes() for b in blocks)
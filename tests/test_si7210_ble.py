@@ -1,64 +1,323 @@
 #!/usr/bin/env python3
 """
-Regression test: Si7210 magnetic sensor reporting over BLE.
+Regression test and benchmark: xG27-Sensor over BLE and through the bridge.
 
 Scans for xG27-Sensor advertisements and verifies:
   1. At least one packet is received (BLE advertising works)
   2. The Si7210 flag (bit 2 of the flags byte) is set in every packet
   3. The reported magnetic field is non-zero (sensor actually measuring)
 
+From the same scan it measures the radio link: report and sample rate,
+duplicate ratio (reports repeating a sample already seen), loss from gaps
+in the sequence numbers (timed and history payloads only) and the jitter
+of the inter-arrival time of new samples.
+
+Unless --clients 0 is given, it then starts host/sensor_server.py on a
+spare port with a throwaway history store, connects N SSE clients to /events and measures the bridge:
+CPU time per sample and bridge receive → client latency, plus the
+bridge's own latency stages from /metrics?format=json. Backfilled history
+samples are left out of the latency, as they were old on arrival. Stop
+the live bridge first: both would scan on the same adapter, so the run
+refuses to start while one answers on port 5555.
+
+Results go to --json as one object; --baseline compares them against an
+earlier run and fails on the regressions in REGRESSION_LIMITS:
+
+    python3 tests/test_si7210_ble.py --json base.json
+    python3 tests/test_si7210_ble.py --baseline base.json --json new.json
+
 Exit code: 0 = PASS, 1 = FAIL
 """
 
+import argparse
 import asyncio
-import struct
+import json
+import os
+import pathlib
+import statistics
+import subprocess
 import sys
-from dataclasses import dataclass
+import tempfile
+import time
+from dataclasses import dataclass, field
+from typing import Any
 
 from bleak import BleakScanner
 
-DEVICE_NAME  = "xG27-Sensor"
-COMPANY_ID   = 0xFFFF
-SCAN_SECONDS = 15
+REPO = pathlib.Path(__file__).resolve().parent.parent
+sys.path.insert(0, str(REPO / "host"))
+import payload  # noqa: E402  (shared decoder, host/payload.py)
+
+DEVICE_NAME    = "xG27-S"  # prefix; timed payloads carry the shortened name
+COMPANY_ID     = 0xFFFF
+SCAN_SECONDS   = 15
+BENCH_CLIENTS  = 10
+BENCH_SECONDS  = 30
+BENCH_WARMUP   = 5         # seconds between bridge start and measuring
+DASHBOARD_PORT = 5555      # a live bridge here shares the adapter with ours
+BRIDGE_PORT    = 5556
+BRIDGE_START   = 10        # seconds to wait for the bridge to answer
+BRIDGE         = REPO / "host" / "sensor_server.py"
+
+# Result path → (kind, limit) against the baseline:
+#   min_ratio  fails below baseline × limit
+#   max_ratio  fails above baseline × limit
+#   max_delta  fails above baseline + limit
+REGRESSION_LIMITS = {
+    "radio.sample_rate_hz":     ("min_ratio", 0.9),
+    "radio.loss_rate":          ("max_delta", 0.01),
+    "radio.jitter_ms.stdev":    ("max_ratio", 1.5),
+    "bridge.cpu_ms_per_sample": ("max_ratio", 1.5),
+    "bridge.latency_ms.p95":    ("max_ratio", 1.5),
+}
 
 
 @dataclass
 class Packet:
+    address: str
+    rx: float             # perf_counter() at reception
     flags: int
     mag_ut: int
+    key: Any              # identifies the newest sample: its seq, or the raw bytes
+    seqs: list[int] = field(default_factory=list)
 
     @property
     def si7210_ok(self) -> bool:
-        return bool(self.flags & 4)
+        return bool(self.flags & payload.FLAG_MAG)
 
 
-def _parse(raw: bytes) -> Packet | None:
-    if len(raw) < 8:
+def _parse(address: str, rx: float, raw: bytes) -> Packet | None:
+    samples = payload.decode(raw)
+    if not samples:
         return None
-    mag   = struct.unpack_from("<h", raw, 5)[0]
-    flags = raw[7]
-    return Packet(flags=flags, mag_ut=mag)
+    newest = samples[-1]
+    seqs = [d["seq"] for d in samples if "seq" in d]
+    return Packet(address=address, rx=rx, flags=newest["f"], mag_ut=int(newest["m"]),
+                  key=newest.get("seq", bytes(raw)), seqs=seqs)
 
 
-async def _collect() -> list[Packet]:
+async def _collect(seconds: float) -> list[Packet]:
     packets: list[Packet] = []
 
     def on_adv(device, adv):
-        if device.name != DEVICE_NAME:
+        if not (device.name or "").startswith(DEVICE_NAME):
             return
         raw = adv.manufacturer_data.get(COMPANY_ID, b"")
-        pkt = _parse(raw)
+        pkt = _parse(device.address, time.perf_counter(), raw)
         if pkt:
             packets.append(pkt)
 
-    print(f"Scanning for '{DEVICE_NAME}' ({SCAN_SECONDS} s)…")
+    print(f"Scanning for '{DEVICE_NAME}' ({seconds:g} s)…")
     async with BleakScanner(on_adv):
-        await asyncio.sleep(SCAN_SECONDS)
+        await asyncio.sleep(seconds)
 
     return packets
 
 
-def _run_tests(packets: list[Packet]) -> bool:
+# ── Measurements ──────────────────────────────────────────────────────────────
+
+def _percentiles(values: list[float]) -> dict[str, Any]:
+    """Same shape as the bridge's /metrics?format=json latency stages."""
+    if not values:
+        return {"n": 0}
+    s = sorted(values)
+    rank = {q: s[min(len(s) - 1, int(q / 100 * len(s)))] for q in (50, 95, 99)}
+    return {
+        "n": len(s),
+        **{f"p{q}": round(v, 2) for q, v in rank.items()},
+        "max": round(s[-1], 2),
+    }
+
+
+def _radio_metrics(packets: list[Packet], seconds: float) -> dict[str, Any]:
+    new = 0
+    received = lost = 0
+    gaps: list[float] = []
+    for address in sorted({p.address for p in packets}):
+        board = [p for p in packets if p.address == address]
+        seen: set[int] = set()
+        last_key = last_rx = None
+        for p in board:
+            seen.update(p.seqs)
+            if p.key == last_key:
+                continue
+            new += 1
+            if last_rx is not None:
+                gaps.append((p.rx - last_rx) * 1000)
+            last_key, last_rx = p.key, p.rx
+        if seen:
+            # Unwrap the 16-bit counter from the first seq on
+            first = board[0].seqs[0] if board[0].seqs else min(seen)
+            span = max((s - first) & 0xFFFF for s in seen if (s - first) & 0xFFFF < 0x8000)
+            received += len(seen)
+            lost += max(0, span + 1 - len(seen))
+    total = len(packets)
+    jitter: dict[str, Any] = {"n": len(gaps)}
+    if len(gaps) >= 2:
+        mean = statistics.fmean(gaps)
+        jitter.update(
+            mean=round(mean, 2),
+            stdev=round(statistics.stdev(gaps), 2),
+            p95_dev=_percentiles([abs(g - mean) for g in gaps])["p95"],
+        )
+    return {
+        "seconds": seconds,
+        "boards": len({p.address for p in packets}),
+        "reports": total,
+        "report_rate_hz": round(total / seconds, 2),
+        "samples": new,
+        "sample_rate_hz": round(new / seconds, 2),
+        "duplicate_ratio": round(1 - new / total, 4) if total else None,
+        "seq_received": received,
+        "seq_lost": lost,
+        "loss_rate": round(lost / (received + lost), 4) if received else None,
+        "jitter_ms": jitter,
+    }
+
+
+def _cpu_seconds(pid: int) -> float | None:
+    """User + system CPU time of a running process."""
+    try:
+        stat = pathlib.Path(f"/proc/{pid}/stat").read_text()
+        fields = stat.rpartition(")")[2].split()
+        return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+    except OSError:
+        pass
+    # No procfs (macOS): ps prints [[dd-]hh:]mm:ss[.cc]
+    try:
+        out = subprocess.run(["ps", "-o", "time=", "-p", str(pid)], capture_output=True,
+                             text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+    days, _, clock = out.rpartition("-")
+    seconds = 0.0
+    for part in clock.split(":"):
+        seconds = seconds * 60 + float(part)
+    return seconds + int(days or 0) * 86400
+
+
+async def _http_json(port: int, path: str) -> Any:
+    reader, writer = await asyncio.open_connection("127.0.0.1", port)
+    try:
+        writer.write(f"GET {path} HTTP/1.1\r\nHost: localhost\r\n\r\n".encode())
+        response = await reader.read()
+    finally:
+        writer.close()
+    return json.loads(response.partition(b"\r\n\r\n")[2])
+
+
+async def _sse_client(port: int, arrivals: list[tuple[float, float]]) -> None:
+    """Read /events and record (sample ts, receive → client ms) per sample."""
+    reader, writer = await asyncio.open_connection("127.0.0.1", port)
+    try:
+        writer.write(b"GET /events HTTP/1.1\r\nHost: localhost\r\n\r\n")
+        while await reader.readline() not in (b"\r\n", b""):
+            pass
+        while line := await reader.readline():
+            if not line.startswith(b"data: "):
+                continue
+            now = time.time()
+            d = json.loads(line[6:])
+            if not d.get("p"):
+                arrivals.append((d["ts"], (now - d["ts"]) * 1000))
+    finally:
+        writer.close()
+
+
+def _bridge_samples(metrics: dict[str, Any]) -> int:
+    return sum(board["received"] for board in metrics["loss"].values())
+
+
+async def _bench_bridge(clients: int, seconds: float, port: int,
+                        scanner: str) -> dict[str, Any]:
+    try:
+        await _http_json(DASHBOARD_PORT, "/stats")
+    except (OSError, ValueError):
+        pass
+    else:
+        # Two scanners on one controller toggle each other's scan, and the
+        # numbers would be neither bridge's
+        raise RuntimeError(f"a bridge is already running on port {DASHBOARD_PORT}; stop it first")
+    print(f"Benchmarking the bridge: {clients} SSE client(s), {seconds:g} s…")
+    tmp = tempfile.TemporaryDirectory(prefix="xg27-bench-")
+    proc = await asyncio.create_subprocess_exec(
+        sys.executable, str(BRIDGE), "--port", str(port), "--scanner", scanner,
+        "--db", str(pathlib.Path(tmp.name) / "history.db"),
+        stdout=subprocess.DEVNULL)
+    arrivals: list[list[tuple[float, float]]] = [[] for _ in range(clients)]
+    tasks: list[asyncio.Task] = []
+    try:
+        deadline = time.monotonic() + BRIDGE_START
+        while True:
+            try:
+                await _http_json(port, "/stats")
+                break
+            except (OSError, ValueError):
+                if proc.returncode is not None or time.monotonic() > deadline:
+                    raise RuntimeError(f"bridge did not start on port {port}")
+                await asyncio.sleep(0.2)
+        tasks = [asyncio.create_task(_sse_client(port, a)) for a in arrivals]
+        await asyncio.sleep(BENCH_WARMUP)
+
+        start = time.time()
+        cpu0 = _cpu_seconds(proc.pid)
+        samples0 = _bridge_samples(await _http_json(port, "/metrics?format=json"))
+        stats0 = await _http_json(port, "/stats")
+        await asyncio.sleep(seconds)
+        cpu1 = _cpu_seconds(proc.pid)
+        metrics = await _http_json(port, "/metrics?format=json")
+        stats = await _http_json(port, "/stats")
+    finally:
+        for task in tasks:
+            task.cancel()
+        await asyncio.gather(*tasks, return_exceptions=True)
+        if proc.returncode is None:
+            proc.terminate()
+        await proc.wait()
+        tmp.cleanup()
+
+    samples = _bridge_samples(metrics) - samples0
+    cpu = cpu1 - cpu0 if cpu0 is not None and cpu1 is not None else None
+    # Only samples the bridge received inside the window; the keyframes
+    # sent on connect and the warm-up are left out
+    window = [[lat for ts, lat in a if ts >= start] for a in arrivals]
+    per_client = [len(w) for w in window]
+    return {
+        "clients": clients,
+        "seconds": seconds,
+        "samples": samples,
+        "sample_rate_hz": round(samples / seconds, 2),
+        "cpu_percent": round(cpu / seconds * 100, 2) if cpu is not None else None,
+        "cpu_ms_per_sample": round(cpu / samples * 1000, 3) if cpu is not None and samples else None,
+        "latency_ms": _percentiles([lat for w in window for lat in w]),
+        "frames_per_client": {"min": min(per_client), "max": max(per_client)},
+        "frames_dropped": stats["frames_dropped"] - stats0["frames_dropped"],
+        "lagging": stats["lagging"],
+        "stages_ms": metrics["latency_ms"],
+    }
+
+
+def _lookup(results: dict[str, Any], path: str) -> Any:
+    value: Any = results
+    for part in path.split("."):
+        if not isinstance(value, dict):
+            return None
+        value = value.get(part)
+    return value
+
+
+def _git_revision() -> str | None:
+    try:
+        return subprocess.run(["git", "describe", "--always", "--dirty"], cwd=REPO,
+                              capture_output=True, text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+# ── Report ────────────────────────────────────────────────────────────────────
+
+def _run_tests(packets: list[Packet], results: dict[str, Any],
+               baseline: dict[str, Any] | None) -> bool:
     passed = True
 
     def check(name: str, ok: bool, detail: str = "") -> None:
@@ -68,11 +327,12 @@ def _run_tests(packets: list[Packet]) -> bool:
         if not ok:
             passed = False
 
+    radio = results["radio"]
     total = len(packets)
     si7210_ready = [p for p in packets if p.si7210_ok]
     nonzero      = [p for p in si7210_ready if p.mag_ut != 0]
 
-    print(f"\nReceived {total} packet(s) in {SCAN_SECONDS} s\n")
+    print(f"\nReceived {total} packet(s) in {radio['seconds']:g} s\n")
 
     check(
         "BLE advertising active",
@@ -93,13 +353,74 @@ def _run_tests(packets: list[Packet]) -> bool:
         ),
     )
 
+    print(f"\n  radio:  {radio['sample_rate_hz']} samples/s from {radio['report_rate_hz']}"
+          f" reports/s, duplicates {radio['duplicate_ratio']}, loss {radio['loss_rate']},"
+          f" jitter {radio['jitter_ms']}")
+    bridge = results.get("bridge")
+    if bridge:
+        print(f"  bridge: {bridge['sample_rate_hz']} samples/s,"
+              f" {bridge['cpu_ms_per_sample']} ms CPU/sample, {bridge['cpu_percent']} % CPU,"
+              f" latency {bridge['latency_ms']}")
+        check(
+            "Every SSE client received samples",
+            bridge["frames_per_client"]["min"] > 0,
+            f"{bridge['frames_per_client']['min']}–{bridge['frames_per_client']['max']} per client",
+        )
+
+    if baseline is not None:
+        print(f"\nAgainst baseline {baseline.get('revision')}:\n")
+        for path, (kind, limit) in REGRESSION_LIMITS.items():
+            new, old = _lookup(results, path), _lookup(baseline, path)
+            if new is None or old is None:
+                continue
+            if kind == "min_ratio":
+                ok = new >= old * limit
+            elif kind == "max_ratio":
+                ok = new <= old * limit
+            else:
+                ok = new <= old + limit
+            check(f"No regression in {path}", ok, f"{old} → {new}")
+
     return passed
 
 
+def _parse_args() -> argparse.Namespace:
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    ap.add_argument("--seconds", type=float, default=SCAN_SECONDS,
+                    help="radio scan length (default: %(default)s)")
+    ap.add_argument("--clients", type=int, default=BENCH_CLIENTS,
+                    help="SSE clients for the bridge run, 0 to skip it; stop the live "
+                         "bridge first (default: %(default)s)")
+    ap.add_argument("--bench-seconds", type=float, default=BENCH_SECONDS,
+                    help="bridge run length (default: %(default)s)")
+    ap.add_argument("--port", type=int, default=BRIDGE_PORT,
+                    help="HTTP port for the benchmarked bridge (default: %(default)s)")
+    ap.add_argument("--scanner", choices=("auto", "hci", "bleak"), default="auto",
+                    help="BLE backend of the benchmarked bridge (default: %(default)s)")
+    ap.add_argument("--json", metavar="PATH", type=pathlib.Path,
+                    help="write the results here as JSON")
+    ap.add_argument("--baseline", metavar="PATH", type=pathlib.Path,
+                    help="fail on regressions against these earlier results")
+    return ap.parse_args()
+
+
 def main() -> int:
-    packets = asyncio.run(_collect())
-    ok = _run_tests(packets)
+    args = _parse_args()
+    baseline = json.loads(args.baseline.read_text()) if args.baseline else None
+    packets = asyncio.run(_collect(args.seconds))
+    results: dict[str, Any] = {
+        "revision": _git_revision(),
+        "time": round(time.time(), 3),
+        "radio": _radio_metrics(packets, args.seconds),
+    }
+    if args.clients > 0:
+        results["bridge"] = asyncio.run(
+            _bench_bridge(args.clients, args.bench_seconds, args.port, args.scanner))
+    ok = _run_tests(packets, results, baseline)
+    results["passed"] = ok
     print(f"\n{'PASSED' if ok else 'FAILED'}")
+    if args.json is not None:
+        args.json.write_text(json.dumps(results, indent=2) + "\n")
     return 0 if ok else 1
 
 